@@ -15,6 +15,17 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += \
         j1939.cpp \
+        j1939_archive.cpp \
+        j1939_batch.cpp \
+        j1939_decoder.cpp \
+        j1939_diagnostics.cpp \
+        j1939_link.cpp \
+        j1939_receiver.cpp \
+        j1939_recovery.cpp \
+        j1939_responder.cpp \
+        j1939_rt.cpp \
+        j1939_snapshot.cpp \
+        j1939_txscheduler.cpp \
         main.cpp
 
 RESOURCES += \
@@ -32,7 +43,6 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 DISTFILES += \
-    canSocketStarter.sh \
     images/fuel-icon.png \
     images/logo.png \
     images/no_conect.png \
@@ -41,12 +51,24 @@ DISTFILES += \
     qml/Dashboard.qml \
     qml/DashboardGaugeStyle.qml \
     qml/IconGaugeStyle.qml \
-    qml/TachometerStyle.qml \
-    canSocketStarter.sh
+    qml/TachometerStyle.qml
 
 HEADERS += \
     j1939.h \
-    j1939_config.h
+    j1939_archive.h \
+    j1939_batch.h \
+    j1939_bus.h \
+    j1939_config.h \
+    j1939_decoder.h \
+    j1939_diagnostics.h \
+    j1939_link.h \
+    j1939_queue.h \
+    j1939_receiver.h \
+    j1939_recovery.h \
+    j1939_responder.h \
+    j1939_rt.h \
+    j1939_snapshot.h \
+    j1939_txscheduler.h
 
 LIBS +=-L/urs/local/lib -lwiringPi
 
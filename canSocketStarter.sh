@@ -1,2 +0,0 @@
-sudo ip link set can0 down
-sudo ip link set can0 up type can bitrate 500000 loopback off
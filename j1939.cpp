@@ -1,40 +1,135 @@
 #include "j1939.h"
+#include <cstring>
+#include <linux/can.h>
 
 /******************************************************************************
 * FUNCTION: j1939()
 *
 * DESCRIPTION: This is the constructor of the class, used to initialize some
-*              values, call the connectDevice fuction and connect the signal
-*              with its corresponding slot.
+*              values and start the bring up of the CAN interface on a worker
+*              thread. connectDevice is called once the link is up, so the
+*              QML keeps loading meanwhile. The interface can be changed with
+*              the JD_CAN_INTERFACE environment variable, e.g. vcan0. With
+*              JD_RT_PROFILE=1 frames are received and decoded by a
+*              j1939Receiver thread with the real-time profile. With
+*              JD_SNAPSHOT the last known state is restored from that file
+*              and saved back to it while running.
 *
 * PARAMETERS:  None
 *
 * Return:      None
 ******************************************************************************/
 j1939::j1939(QObject *parent) : QObject(parent) {
-    connectDevice();
-    connect(m_canDevice, &QCanBusDevice::framesReceived,
-            this, &j1939::processFrames);
+    m_txScheduler = new j1939TxScheduler(this);
+    m_responder = new j1939Responder(this, this);
+    connect(m_responder, &j1939Responder::sendFrame,
+            this, &j1939::writeFrame);
+    m_diagnostics = new j1939Diagnostics(this, this);
+    connect(m_diagnostics, &j1939Diagnostics::sendFrame,
+            this, &j1939::writeFrame);
+    connect(m_diagnostics, &j1939Diagnostics::clearCompleted,
+            this, &j1939::resetCompleted);
+    connect(m_diagnostics, &j1939Diagnostics::requestTimedOut,
+            this, &j1939::resetTimedOut);
     TachometerFaultStates  = DTC_NO_FAULTS;
     FuelGaugeFaultStates =   DTC_NO_FAULTS;
     ThermometerFaultStates = DTC_NO_FAULTS;
     LinearFaultStates = DTC_NO_FAULTS;
     TemperatureFaultStates = DTC_NO_FAULTS;
     PositionFaultStates = DTC_NO_FAULTS;
-    emit canBusConnected();
+    TachometerNewFaults = DTC_NO_NEW_FAULTS;
+    FuelGaugeNewFaults = DTC_NO_NEW_FAULTS;
+    ThermometerNewFaults = DTC_NO_NEW_FAULTS;
+    LinearNewFaults = DTC_NO_NEW_FAULTS;
+    TemperatureNewFaults = DTC_NO_NEW_FAULTS;
+    PositionNewFaults = DTC_NO_NEW_FAULTS;
+
+    memset(&m_snapshot.state, 0, sizeof(m_snapshot.state));
+    QString snapshotPath = QString::fromLocal8Bit(qgetenv(SNAPSHOT_ENV));
+    if (!snapshotPath.isEmpty()) {
+        restoreSnapshot(snapshotPath);
+        m_snapshotWriter = new j1939SnapshotWriter(snapshotPath, this);
+        m_snapshotWriter->start();
+        connect(&m_snapshotTimer, &QTimer::timeout,
+                this, &j1939::saveSnapshot);
+        m_snapshotTimer.start(SNAPSHOT_PERIOD_MS);
+    }
+
+    QByteArray archivePath = qgetenv(ARCHIVE_ENV);
+    if (!archivePath.isEmpty()) {
+        m_archive = new j1939ArchiveWriter();
+        if (!m_archive->open(archivePath.toStdString(), true))
+            qDebug() << "Can't open archive" << archivePath;
+    }
+    for (int signal = 0; signal < A_SIGNAL_COUNT; signal++) {
+        m_display.push_back(j1939Subscriber(&m_bus, signal));
+        if (m_archive)
+            m_logger.push_back(j1939Subscriber(&m_bus, signal));
+    }
+
+    m_interface = QString::fromLocal8Bit(qgetenv(CAN_INTERFACE_ENV));
+    if (m_interface.isEmpty())
+        m_interface = QStringLiteral(CAN_INTERFACE);
+
+    // the link object lives on m_linkThread until the destructor, it is asked
+    // to bring the interface up again on every reconnect
+    m_recovery = new j1939Recovery(this);
+    m_link = new j1939Link(m_interface);
+    m_linkThread = new QThread(this);
+    m_link->moveToThread(m_linkThread);
+    connect(m_linkThread, &QThread::started, m_link, &j1939Link::bringUp);
+    connect(m_linkThread, &QThread::finished, m_link, &QObject::deleteLater);
+    connect(m_link, &j1939Link::linkUp, this, &j1939::connectDevice);
+    connect(m_link, &j1939Link::linkFailed,
+            m_recovery, &j1939Recovery::attemptFailed);
+    connect(m_recovery, &j1939Recovery::reconnect,
+            m_link, &j1939Link::bringUp);
+    m_linkThread->start();
+
+    m_rtProfile = rtProfileFromEnv();
+    if (m_rtProfile.enabled) {
+        m_receiver = new j1939Receiver(m_interface, m_rtProfile, &m_bus,
+                                       &m_latency, this);
+        connect(m_receiver, &j1939Receiver::frameReceived,
+                this, &j1939::processFrame);
+        // direct, the frame must be recorded before the write
+        connect(m_txScheduler, &j1939TxScheduler::frameWriting,
+                m_receiver, &j1939Receiver::frameSent, Qt::DirectConnection);
+        connect(m_txScheduler, &j1939TxScheduler::frameNotWritten,
+                m_receiver, &j1939Receiver::frameNotSent,
+                Qt::DirectConnection);
+        connect(&m_busTimer, &QTimer::timeout,
+                this, &j1939::consumeSamples);
+        m_busTimer.start(BUS_POLL_MS);
+        m_receiver->start();
+    }
 }
 
 /******************************************************************************
 * FUNCTION: ~j1939()
 *
 * DESCRIPTION: This is the the destructor of the class, used to disconect the
-*              canDevice
+*              canDevice. The jitter report of the receive path is printed
+*              and the last snapshot is written.
 *
 * PARAMETERS:  None
 *
 * Return:      None
 ******************************************************************************/
 j1939::~j1939() {
+    // the receiver writes m_bus and m_latency, stop it before members go away
+    delete m_receiver;
+    qDebug().noquote() << latencyReport();
+    if (m_snapshotWriter) {
+        storeSnapshot(true);
+        delete m_snapshotWriter;
+    }
+    m_linkThread->quit();
+    m_linkThread->wait();
+    delete m_archive;
+    if (!m_canDevice)
+        return;
+    disconnect(m_canDevice, nullptr, this, nullptr);
     m_canDevice->disconnectDevice();
     delete m_canDevice;
 }
@@ -43,26 +138,117 @@ j1939::~j1939() {
 * FUNCTION: j1939::connectDevice()
 *
 * DESCRIPTION: This function create a connection with the can0 device using the
-*              socketcan plugin.
+*              socketcan plugin. It is called when j1939Link reports the
+*              interface is up, at startup and after every recovery. Error
+*              frames are enabled so bus-off can be detected. When the
+*              j1939Receiver is running, data frames are filtered out with a
+*              filter no J1939 frame matches, so the device only reports
+*              errors and transmits.
 *
 * PARAMETERS:  none
 *
 * Return:      none
 ******************************************************************************/
 void j1939::connectDevice() {
+    if (m_canDevice)
+        return;
     QString errorString = "Error, no can device connected";
     m_canDevice = QCanBus::instance()->createDevice(
-                QStringLiteral("socketcan"),
-                QStringLiteral("can0"), &errorString);
+                QStringLiteral("socketcan"), m_interface, &errorString);
     if (!m_canDevice) {
+        qDebug() << errorString;
+        m_recovery->attemptFailed();
+        return;
+    }
+
+    m_canDevice->setConfigurationParameter(
+                QCanBusDevice::ErrorFilterKey,
+                QVariant::fromValue(QCanBusFrame::FrameErrors(
+                                        QCanBusFrame::AnyError)));
+    if (m_receiver) {
+        QCanBusDevice::Filter filter;
+        filter.frameId = 0;
+        filter.frameIdMask = CAN_SFF_MASK;
+        filter.type = QCanBusFrame::DataFrame;
+        filter.format = QCanBusDevice::Filter::MatchBaseFormat;
+        QList<QCanBusDevice::Filter> filters;
+        filters << filter;
+        m_canDevice->setConfigurationParameter(QCanBusDevice::RawFilterKey,
+                                               QVariant::fromValue(filters));
+    }
+    if (!m_canDevice->connectDevice()) {
+        qDebug() << m_canDevice->errorString();
+        delete m_canDevice;
+        m_canDevice = nullptr;
+        m_recovery->attemptFailed();
+        return;
+    }
 
-        // Error handling goes here
+    connect(m_canDevice, &QCanBusDevice::framesReceived,
+            this, &j1939::processFrames);
+    connect(m_canDevice, &QCanBusDevice::errorOccurred,
+            this, &j1939::deviceError);
+    connect(m_canDevice, &QCanBusDevice::stateChanged,
+            this, &j1939::deviceStateChanged);
+    m_txScheduler->setDevice(m_canDevice);
+    m_recovery->recovered();
+    Connected = true;
+    j1939Link::markPhase("device connected");
+    qDebug() << "Device Connected";
+    emit connectedChanged();
+    emit canBusConnected();
+}
 
-        qDebug() << errorString;
-    } else {
-        m_canDevice->connectDevice();
-        qDebug() << "Device Connected";
+/******************************************************************************
+* FUNCTION: j1939::releaseDevice()
+*
+* DESCRIPTION: This function drops a faulty device and starts the recovery.
+*              Frames sent meanwhile stay in the TX scheduler until the new
+*              device is connected.
+*
+* PARAMETERS:  reason- description of the fault.
+*
+* Return:      None
+******************************************************************************/
+void j1939::releaseDevice(const QString &reason) {
+    if (m_canDevice) {
+        disconnect(m_canDevice, nullptr, this, nullptr);
+        m_txScheduler->setDevice(nullptr);
+        m_canDevice->disconnectDevice();
+        m_canDevice->deleteLater();
+        m_canDevice = nullptr;
+    }
+    if (Connected) {
+        Connected = false;
+        emit connectedChanged();
     }
+    m_recovery->fault(reason);
+}
+
+/******************************************************************************
+* FUNCTION: j1939::deviceError()
+*
+* DESCRIPTION: This function is executed when the device reports an error.
+*              Read and connection errors mean the interface went away or
+*              down, so the device is released and reconnected.
+*
+* PARAMETERS:  error- the device error.
+*
+* Return:      None
+******************************************************************************/
+void j1939::deviceError(QCanBusDevice::CanBusError error) {
+    m_recovery->deviceError(error);
+    if (!m_canDevice)
+        return;
+    qDebug() << "CAN device error:" << m_canDevice->errorString();
+    if (error == QCanBusDevice::ReadError ||
+            error == QCanBusDevice::ConnectionError)
+        releaseDevice(m_canDevice->errorString());
+}
+
+void j1939::deviceStateChanged(QCanBusDevice::CanBusDeviceState state) {
+    if (state == QCanBusDevice::UnconnectedState && Connected)
+        releaseDevice(QStringLiteral("device disconnected"));
 }
 
 
@@ -75,13 +261,15 @@ void j1939::connectDevice() {
 * PARAMETERS:  PGN- The PGN that will be assigned to frame.
 *              addr - The address to be included in the message.
 *              payload- The payload to be included in the frame.
+*              priority- The J1939 priority, used by the TX scheduler.
 *
 * Return:      A can frame compliant with the J1939 protocol.
 ******************************************************************************/
-QCanBusFrame j1939::prepareCANFrame(quint16 PGN, quint8 addr, QByteArray payload) {
+QCanBusFrame j1939::prepareCANFrame(quint16 PGN, quint8 addr, QByteArray payload,
+                                    quint8 priority) {
     QCanBusFrame frame;
 
-    Priority =      ECU_PRIORITY_LEVEL;
+    Priority =      priority;
     ExtendedData =  EXTENDED_DATA_BIT ;
     DataPage =      DATA_PAGE_BIT;
     SourceAddress = addr;
@@ -96,48 +284,89 @@ QCanBusFrame j1939::prepareCANFrame(quint16 PGN, quint8 addr, QByteArray payload
     return frame;
 }
 
+/******************************************************************************
+* FUNCTION: j1939::writeFrame()
+*
+* DESCRIPTION: This function queues a frame in the TX scheduler, every
+*              transmission of the class goes through it.
+*
+* PARAMETERS:  frame- the frame to be written on the bus.
+*
+* Return:      None
+******************************************************************************/
+void j1939::writeFrame(const QCanBusFrame &frame) {
+    if (!m_txScheduler->enqueue(frame))
+        qDebug() << "TX queue full, frame dropped" << frame.frameId();
+}
+
 /******************************************************************************
 * FUNCTION: j1939::sendStatusReset()
 *
 * DESCRIPTION: This function is called when the status reset button is clicked.
+*              The device is asked to clear its active DTCs with DM11, the
+*              fault state is only reset once it acknowledges, see
+*              resetCompleted().
 *
-* PARAMETERS:  device- device PGN to request fault reset
+* PARAMETERS:  n- device to reset: 1 linear, 2 position, 3 temperature.
 *
 * Return:      None
 ******************************************************************************/
 void j1939::sendStatusReset(QString n) {
-    int opt = n.toInt();
-    QCanBusFrame frame;
-    QByteArray payload(BYTE_DATA_PER_PACKET, DTC_NO_FAULTS);
-    quint16 PGN = 0x0000;
-    quint8 addrsend = 0;
-    //qDebug() << "Reset";
-    switch (opt){
+    quint8 address = 0;
+    switch (n.toInt()) {
     case 1:
-        //Linear
-        PGN = DM1_PGN;
-        LinearFaultStates = DTC_NO_FAULTS;
-        addrsend = 0x48;
-        //qDebug() << PGN;
+        address = LINEAR_ADR;
         break;
     case 2:
-        //Position
-        PGN = DM1_PGN;
-        TemperatureFaultStates = DTC_NO_FAULTS;
-        addrsend = 0x63;
-        //qDebug() << PGN;
+        address = POS_ADR;
         break;
     case 3:
-        //Temperature
-        PGN = DM1_PGN;
+        address = TEMP_ADR;
+        break;
+    default:
+        return;
+    }
+    m_resetRequests.insert(m_diagnostics->clearActiveDTCs(address));
+}
+
+/******************************************************************************
+* FUNCTION: j1939::resetCompleted()
+*
+* DESCRIPTION: This function receives the result of a DM11 sent by
+*              sendStatusReset(). On the acknowledgement the fault state of
+*              the device is reset and its DTC becomes previously active.
+*
+* PARAMETERS:  id- the diagnostic request id.
+*              address- the device address.
+*              acknowledged- false if the device refused the reset.
+*
+* Return:      None
+******************************************************************************/
+void j1939::resetCompleted(int id, int address, bool acknowledged) {
+    if (!m_resetRequests.remove(id))
+        return;
+    if (!acknowledged) {
+        qDebug() << "Fault reset refused by" << address;
+        return;
+    }
+    switch (address) {
+    case LINEAR_ADR:
+        LinearFaultStates = DTC_NO_FAULTS;
+        break;
+    case POS_ADR:
         PositionFaultStates = DTC_NO_FAULTS;
-        addrsend = 0x50;
-        //qDebug() << PGN;
+        break;
+    case TEMP_ADR:
+        TemperatureFaultStates = DTC_NO_FAULTS;
         break;
     }
-    frame = prepareCANFrame(PGN, addrsend, payload);
-    m_canDevice->writeFrame(frame);
-    //qDebug() << frame.frameId();
+    clearDTC(quint8(address));
+}
+
+void j1939::resetTimedOut(int id, int address, int PGN) {
+    Q_UNUSED(PGN);
+    if (m_resetRequests.remove(id))
+        qDebug() << "Fault reset not answered by" << address;
 }
 
 /******************************************************************************
@@ -153,7 +382,7 @@ void j1939::sendStatusReset(QString n) {
 void j1939::sendData(QString n){
     int device = n.toInt();
     QCanBusFrame frame;
-    QByteArray payload(BYTE_DATA_PER_PACKET, 0xFF);
+    QByteArray payload;
     quint16 PGN = 0x0000;
     quint8 addrsend = 0;
     //qDebug() << "Reset";
@@ -161,7 +390,6 @@ void j1939::sendData(QString n){
     case 1:{
         // TREAD_POS_PGN = 0xFFF8
         PGN = TREAD_POS_PGN;
-        payload[3] = linearSP;
         addrsend = LINEAR_ADR;
         break;
     }
@@ -169,21 +397,20 @@ void j1939::sendData(QString n){
     case 2:{
         // HEATER_SP_PGN = 0xF037
         PGN = HEATER_SP_PGN;
-        payload[0] = tempSP;
         addrsend = TEMP_ADR;
         break;
     }
     }
-    frame = prepareCANFrame(PGN, addrsend, payload);
-    m_canDevice->writeFrame(frame);
+    payload = setpointPayload(PGN);
+    frame = prepareCANFrame(PGN, addrsend, payload, CONTROL_PRIORITY_LEVEL);
+    writeFrame(frame);
 }
 
 /******************************************************************************
 * FUNCTION: j1939::processFrames()
 *
 * DESCRIPTION: This fuction is executed in the reception of a can frame. If
-*              there are frames availables the specificed PGN is checking to
-*              execute some tasks.
+*              there are frames availables each one is processed.
 *
 * PARAMETERS:  None
 *
@@ -194,190 +421,416 @@ void j1939::processFrames() {
         //qDebug() << "No Device";
         return;
     }
-    while (m_canDevice->framesAvailable()){
-        QCanBusFrame frame = m_canDevice->readFrame();
-        quint32 canId = frame.frameId();
-
-        Priority =      (canId & ID_PRIORITY_MASK) >> PRIORITY_SHIFT_POSITION;
-        ExtendedData =  (canId & EXTENDED_DATA_MASK) >>
-                                                        EXTENDED_DATA_SHIFT_POSITION;
-        DataPage =      (canId & DATA_PAGE_MASK) >> DATA_PAGE_SHIFT_POSITION;
-        PDUFormat =     (canId & PDU_FORMAT_MASK) >> PDU_FORMAT_SHIFT_POSITION;
-        PDUSpecific =   (canId & PDU_SPECIFIC_MASK) >> PGN_SHIFT_POSITION;
-        SourceAddress = (canId & SOURCE_ADRESS_MASK);
-
-        //qDebug() << "Can Id: " << canId;
-        //qDebug() << "P: " << Priority;
-        //qDebug() << "ED: " << ExtendedData;
-        //qDebug() << "D: " << DataPage;
-        //qDebug() << "PDUF " << PDUFormat;
-        //qDebug() << "PDUS: " << PDUSpecific;
-        //qDebug() << "SA: " << SourceAddress;
-
-        QByteArray payload;
-        payload = frame.payload();
-        uint data, data2;
-        quint8 PreviousStates;
-        quint8 address;
-
-        qDebug() << "MSG RECEIVED" << getPGN(canId);
-
-        /*
+    while (m_canDevice && m_canDevice->framesAvailable())
+        processFrame(m_canDevice->readFrame());
+}
+
+/******************************************************************************
+* FUNCTION: j1939::processFrame()
+*
+* DESCRIPTION: This fuction processes a received can frame, the specificed PGN
+*              is checking to execute some tasks. Measurement PGNs are decoded
+*              by j1939Decode() and published on the signal bus.
+*
+* PARAMETERS:  frame- the received frame.
+*
+* Return:      None
+******************************************************************************/
+void j1939::processFrame(QCanBusFrame frame) {
+    quint32 canId = frame.frameId();
+    if (frame.frameType() == QCanBusFrame::ErrorFrame) {
+        if (m_recovery->errorFrame(frame))
+            releaseDevice(QStringLiteral("bus-off"));
+        return;
+    }
+    // with the receiver most frames never get here, it marks the first one
+    if (!m_firstFrame && !m_receiver) {
+        m_firstFrame = true;
+        j1939Link::markPhase("first frame");
+    }
+
+    Priority =      (canId & ID_PRIORITY_MASK) >> PRIORITY_SHIFT_POSITION;
+    ExtendedData =  (canId & EXTENDED_DATA_MASK) >>
+                                                    EXTENDED_DATA_SHIFT_POSITION;
+    DataPage =      (canId & DATA_PAGE_MASK) >> DATA_PAGE_SHIFT_POSITION;
+    PDUFormat =     (canId & PDU_FORMAT_MASK) >> PDU_FORMAT_SHIFT_POSITION;
+    PDUSpecific =   (canId & PDU_SPECIFIC_MASK) >> PGN_SHIFT_POSITION;
+    SourceAddress = (canId & SOURCE_ADRESS_MASK);
+    markAddress(SourceAddress);
+
+    // Request PGN is PDU1, its PS field holds the destination address
+    if (PDUFormat == (REQUEST_PGN >> PGN_SHIFT_POSITION)) {
+        m_responder->handleRequest(frame);
+        return;
+    }
+    // Responses to the diagnostic client and transport sessions
+    if (m_diagnostics->handleFrame(frame))
+        return;
+
+    //qDebug() << "Can Id: " << canId;
+    //qDebug() << "P: " << Priority;
+    //qDebug() << "ED: " << ExtendedData;
+    //qDebug() << "D: " << DataPage;
+    //qDebug() << "PDUF " << PDUFormat;
+    //qDebug() << "PDUS: " << PDUSpecific;
+    //qDebug() << "SA: " << SourceAddress;
+
+    QByteArray payload;
+    payload = frame.payload();
+    quint8 PreviousStates;
+    quint8 address;
+
+    j1939Sample samples[DECODE_MAX_SAMPLES];
+    int count = j1939Decode(canId, reinterpret_cast<const quint8 *>(
+                                payload.constData()),
+                            payload.size(), frameTime(frame), samples);
+    if (count) {
+        for (int i = 0; i < count; i++)
+            m_bus.publish(samples[i]);
+        m_latency.record(realtimeMicros() - samples[0].time);
+        consumeSamples();
+        return;
+    }
+
+    qDebug() << "MSG RECEIVED" << getPGN(canId);
+
+    /*
        * this switch takes the PGN of the CAN frame, and if it matches the
        * PGN of the relevant data for the system, enters the respective switch
        * case and executes the required data extraction and processing, end
        * emits a signal to inform there is new data available.
       */
 
-        switch (getPGN(canId)) {
-        case TEMPERATURE_DTC:{
-            PreviousStates = ThermometerFaultStates;
-            //checks all of the payload bytes for content.
-            for (int i = BIT_CHECK_BEGINNING; i < BIT_CHECK_END; i++) {
-                //if it has content, a DTC is detected. Same for all DTC cases.
-                if (payload.at(i) != EMPTY_PAYLOAD) {
-                    ThermometerFaultStates |= (DTC_BITMASK << i) ;
-                }
+    switch (getPGN(canId)) {
+    case TEMPERATURE_DTC:{
+        PreviousStates = ThermometerFaultStates;
+        //checks all of the payload bytes for content.
+        for (int i = BIT_CHECK_BEGINNING; i < BIT_CHECK_END; i++) {
+            //if it has content, a DTC is detected. Same for all DTC cases.
+            if (payload.at(i) != EMPTY_PAYLOAD) {
+                ThermometerFaultStates |= (DTC_BITMASK << i) ;
             }
-            ThermometerNewFaults = PreviousStates ^
-                    (ThermometerFaultStates | PreviousStates);
-            if (ThermometerNewFaults != DTC_NO_NEW_FAULTS)
-                emit thermometerNewFaultsChanged();
-            //qDebug() << "Thermo DTC: " << ThermometerFaultStates;
-            //qDebug() << "New Faults: " << ThermometerNewFaults;
-            //qDebug() << "PGN: " << getPGN(canId);
-            break;
         }
+        ThermometerNewFaults = PreviousStates ^
+                (ThermometerFaultStates | PreviousStates);
+        if (ThermometerNewFaults != DTC_NO_NEW_FAULTS)
+            emit thermometerNewFaultsChanged();
+        //qDebug() << "Thermo DTC: " << ThermometerFaultStates;
+        //qDebug() << "New Faults: " << ThermometerNewFaults;
+        //qDebug() << "PGN: " << getPGN(canId);
+        break;
+    }
 
-        case TACHOMETER_DTC:{
-            PreviousStates = TachometerFaultStates;
-            for (int i = BIT_CHECK_BEGINNING; i < BIT_CHECK_END; i++) {
-                if (payload.at(i) != EMPTY_PAYLOAD) {
-                    TachometerFaultStates |= (DTC_BITMASK << i) ;
-                }
+    case TACHOMETER_DTC:{
+        PreviousStates = TachometerFaultStates;
+        for (int i = BIT_CHECK_BEGINNING; i < BIT_CHECK_END; i++) {
+            if (payload.at(i) != EMPTY_PAYLOAD) {
+                TachometerFaultStates |= (DTC_BITMASK << i) ;
             }
-            TachometerNewFaults = PreviousStates ^
-                    (TachometerFaultStates | PreviousStates);
-            if (TachometerNewFaults != DTC_NO_NEW_FAULTS)
-                emit tachometerNewFaultsChanged();
-            //qDebug() << "Tacho DTC: " << TachometerFaultStates;
-            //qDebug() << "New Faults: " << TachometerNewFaults;
-            //qDebug() << "PGN: " << getPGN(canId);
-            break;
         }
+        TachometerNewFaults = PreviousStates ^
+                (TachometerFaultStates | PreviousStates);
+        if (TachometerNewFaults != DTC_NO_NEW_FAULTS)
+            emit tachometerNewFaultsChanged();
+        //qDebug() << "Tacho DTC: " << TachometerFaultStates;
+        //qDebug() << "New Faults: " << TachometerNewFaults;
+        //qDebug() << "PGN: " << getPGN(canId);
+        break;
+    }
 
-        case FUEL_GAUGE_DTC:{
-            PreviousStates = FuelGaugeFaultStates;
-            qDebug() << PreviousStates;
-            for (int i = BIT_CHECK_BEGINNING; i < BIT_CHECK_END; i++) {
-                if (payload.at(i) != EMPTY_PAYLOAD) {
-                    FuelGaugeFaultStates |= (DTC_BITMASK << i) ;
-                }
+    case FUEL_GAUGE_DTC:{
+        PreviousStates = FuelGaugeFaultStates;
+        qDebug() << PreviousStates;
+        for (int i = BIT_CHECK_BEGINNING; i < BIT_CHECK_END; i++) {
+            if (payload.at(i) != EMPTY_PAYLOAD) {
+                FuelGaugeFaultStates |= (DTC_BITMASK << i) ;
             }
-            qDebug() << FuelGaugeFaultStates;
-            FuelGaugeNewFaults = PreviousStates ^
-                    (FuelGaugeFaultStates | PreviousStates);
-            if (FuelGaugeNewFaults != DTC_NO_NEW_FAULTS)
-                emit fuelGaugeNewFaultsChanged();
-            qDebug() << FuelGaugeFaultStates;
-            //qDebug() << "Fuel Gauge DTC: " << FuelGaugeFaultStates;
-            //qDebug() << "New Faults: " << FuelGaugeNewFaults;
-            //qDebug() << "PGN: " << gtPGN(canId);
-            break;
         }
+        qDebug() << FuelGaugeFaultStates;
+        FuelGaugeNewFaults = PreviousStates ^
+                (FuelGaugeFaultStates | PreviousStates);
+        if (FuelGaugeNewFaults != DTC_NO_NEW_FAULTS)
+            emit fuelGaugeNewFaultsChanged();
+        qDebug() << FuelGaugeFaultStates;
+        //qDebug() << "Fuel Gauge DTC: " << FuelGaugeFaultStates;
+        //qDebug() << "New Faults: " << FuelGaugeNewFaults;
+        //qDebug() << "PGN: " << gtPGN(canId);
+        break;
+    }
 
-        case DM1_PGN:{
-            qDebug() << "DM1 Active Diagnostic Detected";
-            address = getAddr(canId);
-
-            switch(address){
-            case LINEAR_ADR:{
-                qDebug() << "Linear";
-                PreviousStates = LinearNewFaults;
-                LinearNewFaults = (payload.at(FMI_POS) & FMI_MASK);
-                emit linearNewFaultsChanged();
-                qDebug() << LinearNewFaults;
-                break;
-            }
-            case TEMP_ADR:{
-                qDebug() << "Temperature";
-                PreviousStates = TemperatureNewFaults;
-                TemperatureNewFaults = (payload.at(FMI_POS) & FMI_MASK);
-                emit temperatureNewFaultsChanged();
-                qDebug() << TemperatureNewFaults;
-                break;
-            }
-            case POS_ADR:{
-                qDebug() << "Position";
-                PreviousStates = PositionNewFaults;
-                PositionNewFaults = (payload.at(FMI_POS) & FMI_MASK);
-                emit positionNewFaultsChanged();
-                qDebug() << PositionNewFaults;
-                break;
-            }
-            }
-            break;
-        }
+    case DM1_PGN:{
+        qDebug() << "DM1 Active Diagnostic Detected";
+        address = getAddr(canId);
 
-        case LINEAR_DISPLACEMENT_PGN:{
-            qDebug() << "Linear Displacement Data Detected";
-            data = (uint(payload.at(LINEAR_DISPLACEMENT_MSB)) << MSB_SHIFT_POSITION) |
-                    uint(payload.at(LINEAR_DISPLACEMENT_LSB));
-            LinearDisplacement = static_cast<int>(data) / LINEAR_DISPLACEMENT_CONSTANT;
-            qDebug() << LinearDisplacement;
-            emit linearChanged();
+        switch(address){
+        case LINEAR_ADR:{
+            qDebug() << "Linear";
+            PreviousStates = LinearNewFaults;
+            LinearNewFaults = (payload.at(FMI_POS) & FMI_MASK);
+            emit linearNewFaultsChanged();
+            qDebug() << LinearNewFaults;
             break;
         }
-
-        case ENGINE_TEMPERATURE_PGN:{
-            qDebug() << "Engine Temperature Data Detected";
-            data = (uint(payload.at(ENGINE_TEMPERATURE_B)));
-
-            Temperature = static_cast<int>(data) - ENGINE_TEMPERATURE_OFFSET;
-            qDebug() << data;
-            emit temperatureChanged();
+        case TEMP_ADR:{
+            qDebug() << "Temperature";
+            PreviousStates = TemperatureNewFaults;
+            TemperatureNewFaults = (payload.at(FMI_POS) & FMI_MASK);
+            emit temperatureNewFaultsChanged();
+            qDebug() << TemperatureNewFaults;
             break;
         }
-
-        case VEHICLE_POSITION_PGN:{
-            qDebug() << "Vehicle Position Data Detected";
-            data = (uint(payload.at(VEHICLE_POSITION_X_MSB)) << MSB_SHIFT_POSITION) |
-                    uint(payload.at(VEHICLE_POSITION_X_LSB));
-            data2 = (uint(payload.at(VEHICLE_POSITION_Y_MSB)) << MSB_SHIFT_POSITION) |
-                    uint(payload.at(VEHICLE_POSITION_Y_LSB));
-            xpos = static_cast<int>(data);
-            ypos = static_cast<int>(data2);
-            qDebug() << data;
-            qDebug() << data2;
-            emit xPosChanged();
-            emit yPosChanged();
+        case POS_ADR:{
+            qDebug() << "Position";
+            PreviousStates = PositionNewFaults;
+            PositionNewFaults = (payload.at(FMI_POS) & FMI_MASK);
+            emit positionNewFaultsChanged();
+            qDebug() << PositionNewFaults;
             break;
         }
-
-        case VEHICLE_ORIENTATION_PGN:{
-            qDebug() << "Vehicle Orientation Data Detected";
-            data = (uint(payload.at(VEHICLE_ORIENTATION_X_MSB)) << MSB_SHIFT_POSITION) |
-                    uint(payload.at(VEHICLE_ORIENTATION_X_LSB));
-            OrientationDegrees = static_cast<int>(data) / ORIENTATION_DEGREES_CONSTANT;
-            qDebug() << OrientationDegrees;
-            emit orientationChanged();
-            break;
         }
+        storeDTC(address, payload);
+        publishDTC(address, frame, payload);
+        break;
+    }
 
-        case TEST_PGN:{
-            qDebug() << "Test PGN detected";
-            quint16 PGN = DM4_TEST_PGN;
-            QByteArray payload(BYTE_DATA_PER_PACKET, 0xFF);
-            payload[3] = 0x00;
-            qDebug() << Payload;
-            frame = prepareCANFrame(PGN, 0x00, payload);
-            m_canDevice->writeFrame(frame);
-            break;
-        }
-        }
+    case TEST_PGN:{
+        qDebug() << "Test PGN detected";
+        quint16 PGN = DM4_TEST_PGN;
+        QByteArray payload(BYTE_DATA_PER_PACKET, 0xFF);
+        payload[3] = 0x00;
+        qDebug() << Payload;
+        frame = prepareCANFrame(PGN, 0x00, payload);
+        writeFrame(frame);
+        break;
+    }
     }
 }
 
+/******************************************************************************
+* FUNCTION: j1939::consumeSamples()
+*
+* DESCRIPTION: This function reads the signal bus for the dashboard and the
+*              archive. The dashboard only shows the newest sample of each
+*              signal, the archive gets all of them.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939::consumeSamples() {
+    j1939Sample sample;
+    for (int signal = 0; signal < A_SIGNAL_COUNT; signal++) {
+        if (m_display[signal].last(sample))
+            applySample(sample);
+        if (m_logger.empty())
+            continue;
+        while (m_logger[signal].next(sample))
+            m_archive->append(sample.signal, sample.time, sample.value);
+    }
+}
+
+/******************************************************************************
+* FUNCTION: j1939::applySample()
+*
+* DESCRIPTION: This function updates a value with a decoded sample and emits a
+*              signal to inform there is new data available.
+*
+* PARAMETERS:  sample- the decoded sample.
+*
+* Return:      None
+******************************************************************************/
+void j1939::applySample(const j1939Sample &sample) {
+    switch (sample.signal) {
+    case A_LINEAR_DISPLACEMENT:
+        qDebug() << "Linear Displacement Data Detected";
+        LinearDisplacement = sample.value;
+        qDebug() << LinearDisplacement;
+        emit linearChanged();
+        break;
+
+    case A_TEMPERATURE:
+        qDebug() << "Engine Temperature Data Detected";
+        Temperature = static_cast<int>(sample.value);
+        qDebug() << Temperature;
+        emit temperatureChanged();
+        break;
+
+    case A_POSITION_X:
+        qDebug() << "Vehicle Position Data Detected";
+        xpos = static_cast<int>(sample.value);
+        qDebug() << xpos;
+        emit xPosChanged();
+        break;
+
+    case A_POSITION_Y:
+        ypos = static_cast<int>(sample.value);
+        qDebug() << ypos;
+        emit yPosChanged();
+        break;
+
+    case A_ORIENTATION:
+        qDebug() << "Vehicle Orientation Data Detected";
+        OrientationDegrees = sample.value;
+        qDebug() << OrientationDegrees;
+        emit orientationChanged();
+        break;
+
+    default:
+        return;
+    }
+    m_snapshot.state.time[sample.signal] = sample.time;
+    m_snapshot.state.value[sample.signal] = sample.value;
+    markAddress(sample.source);
+    markFirstValue();
+}
+
+/******************************************************************************
+* FUNCTION: j1939::saveSnapshot()
+*
+* DESCRIPTION: This function is executed every SNAPSHOT_PERIOD_MS to save the
+*              state, see storeSnapshot().
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939::saveSnapshot() {
+    storeSnapshot(false);
+}
+
+/******************************************************************************
+* FUNCTION: j1939::storeSnapshot()
+*
+* DESCRIPTION: This function hands the current state to the snapshot writer.
+*              A change of the setpoints, faults, DTCs or addresses is saved
+*              at once. The values and their times change with every sample,
+*              so a change of them alone waits SNAPSHOT_VALUES_MS since the
+*              last snapshot. Only the encoding runs on this thread.
+*
+* PARAMETERS:  final- save any change now, at exit.
+*
+* Return:      None
+******************************************************************************/
+void j1939::storeSnapshot(bool final) {
+    SnapshotState &state = m_snapshot.state;
+    state.tempSP = tempSP;
+    state.linearSP = linearSP;
+    state.faultStates[F_TACHOMETER] = TachometerFaultStates;
+    state.faultStates[F_FUEL_GAUGE] = FuelGaugeFaultStates;
+    state.faultStates[F_THERMOMETER] = ThermometerFaultStates;
+    state.faultStates[F_LINEAR] = LinearFaultStates;
+    state.faultStates[F_TEMPERATURE] = TemperatureFaultStates;
+    state.faultStates[F_POSITION] = PositionFaultStates;
+    state.newFaults[F_TACHOMETER] = TachometerNewFaults;
+    state.newFaults[F_FUEL_GAUGE] = FuelGaugeNewFaults;
+    state.newFaults[F_THERMOMETER] = ThermometerNewFaults;
+    state.newFaults[F_LINEAR] = LinearNewFaults;
+    state.newFaults[F_TEMPERATURE] = TemperatureNewFaults;
+    state.newFaults[F_POSITION] = PositionNewFaults;
+    m_snapshot.activeDTCs = ActiveDTCs;
+    m_snapshot.previousDTCs = PreviousDTCs;
+
+    QByteArray snapshot = encodeSnapshot(m_snapshot);
+    if (snapshot == m_savedSnapshot)
+        return;
+    j1939Snapshot settings = m_snapshot;
+    memset(settings.state.time, 0, sizeof(settings.state.time));
+    memset(settings.state.value, 0, sizeof(settings.state.value));
+    QByteArray encodedSettings = encodeSnapshot(settings);
+    if (!final && encodedSettings == m_savedSettings &&
+            m_snapshotAge.isValid() &&
+            !m_snapshotAge.hasExpired(SNAPSHOT_VALUES_MS))
+        return;
+
+    m_savedSnapshot = snapshot;
+    m_savedSettings = encodedSettings;
+    m_snapshotAge.start();
+    m_snapshotWriter->submit(snapshot);
+}
+
+/******************************************************************************
+* FUNCTION: j1939::restoreSnapshot()
+*
+* DESCRIPTION: This function loads the last known state at startup, before
+*              the QML reads the properties. Signals missing from the
+*              snapshot keep their initial value.
+*
+* PARAMETERS:  path- the snapshot file.
+*
+* Return:      None
+******************************************************************************/
+void j1939::restoreSnapshot(const QString &path) {
+    QString error;
+    if (!loadSnapshot(path, &m_snapshot, &error)) {
+        qDebug() << "No snapshot restored from" << path << error;
+        return;
+    }
+    const SnapshotState &state = m_snapshot.state;
+    tempSP = state.tempSP;
+    linearSP = state.linearSP;
+    TachometerFaultStates = state.faultStates[F_TACHOMETER];
+    FuelGaugeFaultStates = state.faultStates[F_FUEL_GAUGE];
+    ThermometerFaultStates = state.faultStates[F_THERMOMETER];
+    LinearFaultStates = state.faultStates[F_LINEAR];
+    TemperatureFaultStates = state.faultStates[F_TEMPERATURE];
+    PositionFaultStates = state.faultStates[F_POSITION];
+    TachometerNewFaults = state.newFaults[F_TACHOMETER];
+    FuelGaugeNewFaults = state.newFaults[F_FUEL_GAUGE];
+    ThermometerNewFaults = state.newFaults[F_THERMOMETER];
+    LinearNewFaults = state.newFaults[F_LINEAR];
+    TemperatureNewFaults = state.newFaults[F_TEMPERATURE];
+    PositionNewFaults = state.newFaults[F_POSITION];
+    ActiveDTCs = m_snapshot.activeDTCs;
+    PreviousDTCs = m_snapshot.previousDTCs;
+    m_responder->invalidate(DM1_PGN);
+    m_responder->invalidate(DM2_PGN);
+
+    if (state.time[A_LINEAR_DISPLACEMENT])
+        LinearDisplacement = state.value[A_LINEAR_DISPLACEMENT];
+    if (state.time[A_TEMPERATURE])
+        Temperature = static_cast<int>(state.value[A_TEMPERATURE]);
+    if (state.time[A_POSITION_X])
+        xpos = static_cast<int>(state.value[A_POSITION_X]);
+    if (state.time[A_POSITION_Y])
+        ypos = static_cast<int>(state.value[A_POSITION_Y]);
+    if (state.time[A_ORIENTATION])
+        OrientationDegrees = state.value[A_ORIENTATION];
+    j1939Link::markPhase("snapshot restored");
+}
+
+/******************************************************************************
+* FUNCTION: j1939::markAddress()
+*
+* DESCRIPTION: This function adds a source address to the table of addresses
+*              heard on the bus.
+*
+* PARAMETERS:  address- the source address.
+*
+* Return:      None
+******************************************************************************/
+void j1939::markAddress(quint8 address) {
+    m_snapshot.state.addresses[address >> 3] |= quint8(1 << (address & 7));
+}
+
+/******************************************************************************
+* FUNCTION: j1939::knownAddresses()
+*
+* DESCRIPTION: This function lists the source addresses heard on the bus,
+*              including those of the restored snapshot.
+*
+* PARAMETERS:  None
+*
+* Return:      The addresses in increasing order.
+******************************************************************************/
+QVariantList j1939::knownAddresses() const {
+    QVariantList addresses;
+    for (int address = 0; address < SNAPSHOT_ADDRESS_BYTES * 8; address++) {
+        if (m_snapshot.state.addresses[address >> 3] & (1 << (address & 7)))
+            addresses.append(address);
+    }
+    return addresses;
+}
+
 /******************************************************************************
 * FUNCTION: j1939::getPGN(quint32 canId)
 *
@@ -399,6 +852,220 @@ quint8 j1939::getAddr(quint32 canId){
     return addr;
 }
 
+/******************************************************************************
+* FUNCTION: j1939::frameTime()
+*
+* DESCRIPTION: This function gives the reception time of a frame, the current
+*              time if the frame has no timestamp.
+*
+* PARAMETERS:  frame- the received frame.
+*
+* Return:      The time in us since the epoch.
+******************************************************************************/
+qint64 j1939::frameTime(const QCanBusFrame &frame) const {
+    QCanBusFrame::TimeStamp stamp = frame.timeStamp();
+    qint64 time = stamp.seconds() * 1000000 + stamp.microSeconds();
+    if (time == 0)
+        time = realtimeMicros();
+    return time;
+}
+
+/******************************************************************************
+* FUNCTION: j1939::publishDTC()
+*
+* DESCRIPTION: This function publishes the first DTC of a DM1 on the signal
+*              bus, the 4 DTC bytes as one value.
+*
+* PARAMETERS:  address- source address of the DM1.
+*              frame- the DM1 frame.
+*              payload- payload of the DM1.
+*
+* Return:      None
+******************************************************************************/
+void j1939::publishDTC(quint8 address, const QCanBusFrame &frame,
+                       const QByteArray &payload) {
+    if (payload.size() < DTC_POS + DTC_LENGTH)
+        return;
+    quint32 DTC = 0;
+    for (int i = DTC_LENGTH - 1; i >= 0; i--)
+        DTC = DTC << 8 | quint8(payload.at(DTC_POS + i));
+
+    j1939Sample sample;
+    sample.time = frameTime(frame);
+    sample.value = DTC;
+    sample.source = address;
+    switch (address) {
+    case LINEAR_ADR:
+        sample.signal = A_LINEAR_DTC;
+        break;
+    case TEMP_ADR:
+        sample.signal = A_TEMPERATURE_DTC;
+        break;
+    case POS_ADR:
+        sample.signal = A_POSITION_DTC;
+        break;
+    default:
+        return;
+    }
+    m_bus.publish(sample);
+    consumeSamples();
+}
+
+/******************************************************************************
+* FUNCTION: j1939::latencyReport()
+*
+* DESCRIPTION: This function gives the jitter report of the receive path,
+*              labelled with the profile it ran with. Run once with and once
+*              without JD_RT_PROFILE to compare them.
+*
+* PARAMETERS:  None
+*
+* Return:      The report.
+******************************************************************************/
+QString j1939::latencyReport() const {
+    QString label = QStringLiteral("receive-to-decode, default scheduling");
+    if (m_rtProfile.enabled)
+        label = QStringLiteral("receive-to-decode, SCHED_FIFO %1, CPU %2")
+                .arg(m_rtProfile.priority)
+                .arg(m_rtProfile.cpu >= 0 ? QString::number(m_rtProfile.cpu)
+                                          : QStringLiteral("any"));
+    return m_latency.report(label);
+}
+
+void j1939::markFirstValue() {
+    if (m_firstValue)
+        return;
+    m_firstValue = true;
+    j1939Link::markPhase("first gauge value");
+}
+
+/******************************************************************************
+* FUNCTION: j1939::encodePGN()
+*
+* DESCRIPTION: This function builds the data of a PGN this ECU can be
+*              requested for. The result may be longer than 8 bytes, splitting
+*              it in frames is left to the caller.
+*
+* PARAMETERS:  PGN- the requested PGN.
+*              ok- set to false if the PGN is not supported.
+*
+* Return:      The PGN data.
+******************************************************************************/
+QByteArray j1939::encodePGN(quint32 PGN, bool *ok) {
+    QByteArray payload;
+    *ok = true;
+    switch (PGN) {
+    case SOFTWARE_ID_PGN:{
+        // first byte holds the number of software identification fields
+        QByteArray id(SOFTWARE_ID_STRING);
+        payload.append(char(id.count('*')));
+        payload.append(id);
+        break;
+    }
+    case COMPONENT_ID_PGN:
+        payload = QByteArray(COMPONENT_ID_STRING);
+        break;
+    case DM1_PGN:
+        payload = diagnosticPayload(ActiveDTCs);
+        break;
+    case DM2_PGN:
+        payload = diagnosticPayload(PreviousDTCs);
+        break;
+    case HEATER_SP_PGN:
+    case TREAD_POS_PGN:
+        payload = setpointPayload(quint16(PGN));
+        break;
+    default:
+        *ok = false;
+        break;
+    }
+    return payload;
+}
+
+/******************************************************************************
+* FUNCTION: j1939::setpointPayload()
+*
+* DESCRIPTION: This function builds the payload that carries the current
+*              setpoint of a device, shared by sendData() and the responder.
+*
+* PARAMETERS:  PGN- HEATER_SP_PGN or TREAD_POS_PGN.
+*
+* Return:      The 8 byte payload.
+******************************************************************************/
+QByteArray j1939::setpointPayload(quint16 PGN) const {
+    QByteArray payload(BYTE_DATA_PER_PACKET, char(0xFF));
+    if (PGN == TREAD_POS_PGN)
+        payload[3] = char(linearSP);
+    else if (PGN == HEATER_SP_PGN)
+        payload[HEATER_SETPOINT_BYTE] = char(tempSP);
+    return payload;
+}
+
+/******************************************************************************
+* FUNCTION: j1939::diagnosticPayload()
+*
+* DESCRIPTION: This function builds a DM1/DM2 message from a DTC store: the
+*              lamp status bytes followed by one 4 byte DTC per device. An
+*              empty store gives the 8 byte "no faults" message.
+*
+* PARAMETERS:  DTCs- the DTC store to encode.
+*
+* Return:      The DM1/DM2 data.
+******************************************************************************/
+QByteArray j1939::diagnosticPayload(const QMap<quint8, QByteArray> &DTCs) const {
+    QByteArray payload;
+    payload.append(char(DTCs.isEmpty() ? DM_LAMP_NO_FAULTS
+                                       : DM_LAMP_AMBER_WARNING));
+    payload.append(char(DM_LAMP_RESERVED));
+    if (DTCs.isEmpty()) {
+        payload.append(QByteArray(DTC_LENGTH, EMPTY_PAYLOAD));
+        payload.append(char(0xFF));
+        payload.append(char(0xFF));
+        return payload;
+    }
+    for (QMap<quint8, QByteArray>::const_iterator it = DTCs.constBegin();
+         it != DTCs.constEnd(); ++it)
+        payload.append(it.value());
+    return payload;
+}
+
+/******************************************************************************
+* FUNCTION: j1939::storeDTC()
+*
+* DESCRIPTION: This function keeps the first DTC of a received DM1 in the DTC
+*              store. A DM1 without SPN and FMI means the device has no active
+*              faults, so its last DTC becomes previously active.
+*
+* PARAMETERS:  address- source address of the DM1.
+*              payload- payload of the DM1.
+*
+* Return:      None
+******************************************************************************/
+void j1939::storeDTC(quint8 address, const QByteArray &payload) {
+    if (payload.size() < DTC_POS + DTC_LENGTH)
+        return;
+    QByteArray DTC = payload.mid(DTC_POS, DTC_LENGTH);
+    bool noFault = DTC.at(0) == EMPTY_PAYLOAD && DTC.at(1) == EMPTY_PAYLOAD &&
+            DTC.at(2) == EMPTY_PAYLOAD;
+
+    if (noFault) {
+        clearDTC(address);
+        return;
+    }
+    if (ActiveDTCs.value(address) == DTC)
+        return;
+    ActiveDTCs.insert(address, DTC);
+    m_responder->invalidate(DM1_PGN);
+}
+
+void j1939::clearDTC(quint8 address) {
+    if (!ActiveDTCs.contains(address))
+        return;
+    PreviousDTCs.insert(address, ActiveDTCs.take(address));
+    m_responder->invalidate(DM1_PGN);
+    m_responder->invalidate(DM2_PGN);
+}
+
 /******************************************************************************
 * FUNCTION: j1939::readRPM()
 *
@@ -471,6 +1138,7 @@ void j1939::setTempSP(QString n){
     else if (tempSP == 255)
         tempSP = 250;
     qDebug() << "tempSP =" << tempSP;
+    m_responder->invalidate(HEATER_SP_PGN);
     emit tempSPChanged();
 }
 
@@ -481,6 +1149,7 @@ void j1939::setLinearSP(QString n){
     else if (linearSP == 255)
         linearSP = 250;
     qDebug() << "linearSP =" << linearSP;
+    m_responder->invalidate(TREAD_POS_PGN);
     emit linearSPChanged();
 }
 
@@ -545,3 +1214,23 @@ quint8 j1939::readPositionNewFaults() const{
     return PositionNewFaults;
 }
 
+bool j1939::readConnected() const{
+    return Connected;
+}
+
+j1939Diagnostics *j1939::readDiagnostics() const{
+    return m_diagnostics;
+}
+
+j1939TxScheduler *j1939::readTxScheduler() const{
+    return m_txScheduler;
+}
+
+j1939Recovery *j1939::readRecovery() const{
+    return m_recovery;
+}
+
+const j1939SignalBus *j1939::signalBus() const{
+    return &m_bus;
+}
+
@@ -11,7 +11,25 @@
 #include <QTimer>
 #include <QColor>
 #include <QMetaType>
+#include <QMap>
+#include <QSet>
+#include <QThread>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QVariantList>
+#include <vector>
 #include "j1939_config.h"
+#include "j1939_archive.h"
+#include "j1939_bus.h"
+#include "j1939_decoder.h"
+#include "j1939_responder.h"
+#include "j1939_diagnostics.h"
+#include "j1939_link.h"
+#include "j1939_receiver.h"
+#include "j1939_recovery.h"
+#include "j1939_rt.h"
+#include "j1939_snapshot.h"
+#include "j1939_txscheduler.h"
 
 /******************************************************************************
  *
@@ -28,6 +46,7 @@
 
 class j1939 : public QObject {
     Q_OBJECT
+    Q_PROPERTY(bool Connected READ readConnected NOTIFY connectedChanged)
     Q_PROPERTY(int xpos READ readXPos NOTIFY xPosChanged)
     Q_PROPERTY(int ypos READ readYPos NOTIFY yPosChanged)
     Q_PROPERTY(int tempSP READ readTempSP
@@ -55,6 +74,9 @@ class j1939 : public QObject {
                NOTIFY temperatureNewFaultsChanged)
     Q_PROPERTY(quint8 PositionNewFaults READ readPositionNewFaults
                NOTIFY positionNewFaultsChanged)
+    Q_PROPERTY(j1939Diagnostics *diagnostics READ readDiagnostics CONSTANT)
+    Q_PROPERTY(j1939TxScheduler *txScheduler READ readTxScheduler CONSTANT)
+    Q_PROPERTY(j1939Recovery *recovery READ readRecovery CONSTANT)
 public:
     /**************************************************************************
    *
@@ -74,8 +96,13 @@ public:
     explicit j1939(QObject *parent = nullptr);
     quint32 getPGN(quint32 canId);
     quint8 getAddr(quint32 canId);
-    QCanBusFrame prepareCANFrame(quint16 PGN, quint8 addr, QByteArray payload);
+    QCanBusFrame prepareCANFrame(quint16 PGN, quint8 addr, QByteArray payload,
+                                 quint8 priority = ECU_PRIORITY_LEVEL);
     QCanBusFrame sendTestFrame(quint16 PGN, QByteArray payload);
+    QByteArray encodePGN(quint32 PGN, bool *ok);
+    Q_INVOKABLE QString latencyReport() const;
+    Q_INVOKABLE QVariantList knownAddresses() const;
+    const j1939SignalBus *signalBus() const;
     ~j1939();
 
 public slots:
@@ -87,8 +114,19 @@ public slots:
     void setTempSP(QString n);
     void setLinearSP(QString n);
 
+private slots:
+    void writeFrame(const QCanBusFrame &frame);
+    void processFrame(QCanBusFrame frame);
+    void consumeSamples();
+    void saveSnapshot();
+    void resetCompleted(int id, int address, bool acknowledged);
+    void resetTimedOut(int id, int address, int PGN);
+    void deviceError(QCanBusDevice::CanBusError error);
+    void deviceStateChanged(QCanBusDevice::CanBusDeviceState state);
+
 signals:
     void canBusConnected();
+    void connectedChanged();
     void rpmChanged();
     void xPosChanged();
     void yPosChanged();
@@ -109,9 +147,6 @@ private:
     // constants used in conversion between byte array values and actual values
     const double RPM_CONVERSION_CONSTANT =        0.125;
     const double FUEL_LEVEL_CONVERSION_CONSTANT = 0.4;
-    const double LINEAR_DISPLACEMENT_CONSTANT =   10;
-    const quint8 ENGINE_TEMPERATURE_OFFSET =      40;
-    const double ORIENTATION_DEGREES_CONSTANT =   128;
 
     //variables used for interpretation of CAN Frames
     quint8 Priority;
@@ -146,9 +181,71 @@ private:
     uint8_t tempSP = 25;
     uint8_t linearSP = 25;
     int boton = 0;
+    bool Connected = false;
+
+    // DTC store, first DTC reported on DM1 by each device indexed by its
+    // source address. Cleared DTCs are moved to the previously active store.
+    QMap<quint8, QByteArray> ActiveDTCs;
+    QMap<quint8, QByteArray> PreviousDTCs;
 
     //additional variables for instances of classes required for operation
     QCanBusDevice *m_canDevice = nullptr;
+    j1939Responder *m_responder = nullptr;
+    j1939Diagnostics *m_diagnostics = nullptr;
+    j1939TxScheduler *m_txScheduler = nullptr;
+    QThread *m_linkThread = nullptr;
+    j1939Link *m_link = nullptr;
+    j1939Recovery *m_recovery = nullptr;
+    QString m_interface;
+
+    void releaseDevice(const QString &reason);
+
+    // real-time receive path, only when JD_RT_PROFILE is set. Latencies of
+    // both receive paths are kept in m_latency.
+    j1939RtProfile m_rtProfile;
+    j1939Receiver *m_receiver = nullptr;
+    j1939LatencyStats m_latency;
+
+    // decoded samples. The dashboard keeps the newest one of each signal,
+    // the archive logger every sample; both read on the thread of this
+    // object, every m_busTimer tick when the receiver publishes.
+    j1939SignalBus m_bus;
+    std::vector<j1939Subscriber> m_display;
+    std::vector<j1939Subscriber> m_logger;
+    QTimer m_busTimer;
+    void applySample(const j1939Sample &sample);
+    void publishDTC(quint8 address, const QCanBusFrame &frame,
+                    const QByteArray &payload);
+
+    // archive of the decoded values, only when JD_ARCHIVE is set
+    j1939ArchiveWriter *m_archive = nullptr;
+    qint64 frameTime(const QCanBusFrame &frame) const;
+
+    // warm-start snapshot, only when JD_SNAPSHOT is set. m_snapshot keeps
+    // the newest values and the source addresses heard, the rest is copied
+    // from the members when it is saved.
+    j1939Snapshot m_snapshot;
+    j1939SnapshotWriter *m_snapshotWriter = nullptr;
+    QByteArray m_savedSnapshot;
+    QByteArray m_savedSettings;
+    QElapsedTimer m_snapshotAge;
+    QTimer m_snapshotTimer;
+    void storeSnapshot(bool final);
+    void restoreSnapshot(const QString &path);
+    void markAddress(quint8 address);
+
+    // DM11 requests of sendStatusReset(), see resetCompleted()
+    QSet<int> m_resetRequests;
+
+    // startup phase marks, see j1939Link::markPhase()
+    bool m_firstFrame = false;
+    bool m_firstValue = false;
+    void markFirstValue();
+
+    QByteArray setpointPayload(quint16 PGN) const;
+    QByteArray diagnosticPayload(const QMap<quint8, QByteArray> &DTCs) const;
+    void storeDTC(quint8 address, const QByteArray &payload);
+    void clearDTC(quint8 address);
 
     //Functions to access the data from qml throught Q_PROPERTY
     double readRPM() const;
@@ -166,6 +263,10 @@ private:
     quint8 readLinearNewFaults() const;
     quint8 readTemperatureNewFaults() const;
     quint8 readPositionNewFaults() const;
+    bool readConnected() const;
+    j1939Diagnostics *readDiagnostics() const;
+    j1939TxScheduler *readTxScheduler() const;
+    j1939Recovery *readRecovery() const;
 };
 
 #endif // CAN_H
@@ -0,0 +1,618 @@
+#include "j1939_archive.h"
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+const char *SIGNAL_NAMES[A_SIGNAL_COUNT] = {
+    "temperature",
+    "linear",
+    "xpos",
+    "ypos",
+    "orientation",
+    "linear_dtc",
+    "temperature_dtc",
+    "position_dtc"
+};
+
+/******************************************************************************
+ *
+ * Bit level writer and reader used by the XOR value encoding, bits are
+ * written MSB first.
+ *
+******************************************************************************/
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<quint8> &out) : m_out(out) {}
+
+    void write(quint64 value, int bits) {
+        for (int i = bits - 1; i >= 0; i--) {
+            if (m_used == 0)
+                m_out.push_back(0);
+            if ((value >> i) & 1)
+                m_out.back() |= quint8(0x80 >> m_used);
+            m_used = (m_used + 1) & 7;
+        }
+    }
+
+private:
+    std::vector<quint8> &m_out;
+    int m_used = 0;
+};
+
+class BitReader {
+public:
+    BitReader(const quint8 *data, size_t size) : m_data(data), m_size(size) {}
+
+    quint64 read(int bits) {
+        quint64 value = 0;
+        for (int i = 0; i < bits; i++) {
+            size_t byte = m_pos >> 3;
+            int bit = 0;
+            if (byte < m_size)
+                bit = (m_data[byte] >> (7 - (m_pos & 7))) & 1;
+            value = (value << 1) | quint64(bit);
+            m_pos++;
+        }
+        return value;
+    }
+
+private:
+    const quint8 *m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+};
+
+void writeVarint(std::vector<quint8> &out, qint64 value) {
+    quint64 zigzag = (quint64(value) << 1) ^ quint64(value >> 63);
+    while (zigzag >= 0x80) {
+        out.push_back(quint8(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(quint8(zigzag));
+}
+
+qint64 readVarint(const quint8 *&data, const quint8 *end) {
+    quint64 zigzag = 0;
+    int shift = 0;
+    while (data < end && shift < 64) {
+        quint8 byte = *data++;
+        zigzag |= quint64(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+        shift += 7;
+    }
+    return qint64(zigzag >> 1) ^ -qint64(zigzag & 1);
+}
+
+quint64 toBits(double value) {
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double fromBits(quint64 bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+int leadingZeros(quint64 value) {
+    int count = 0;
+    for (quint64 mask = quint64(1) << 63; mask && !(value & mask); mask >>= 1)
+        count++;
+    return count;
+}
+
+int trailingZeros(quint64 value) {
+    int count = 0;
+    for (quint64 mask = 1; mask && !(value & mask); mask <<= 1)
+        count++;
+    return count;
+}
+
+/******************************************************************************
+* FUNCTION: encodeTimes()
+*
+* DESCRIPTION: This function stores the first timestamp, the first delta and
+*              then the delta-of-deltas as zigzag varints. Periodic signals
+*              take one byte per sample.
+*
+* PARAMETERS:  samples- the samples of the chunk.
+*              out- the encoded bytes.
+*
+* Return:      None
+******************************************************************************/
+void encodeTimes(const std::vector<ArchiveSample> &samples,
+                 std::vector<quint8> &out) {
+    qint64 previous = 0;
+    qint64 previousDelta = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        qint64 delta = samples[i].time - previous;
+        writeVarint(out, i == 0 ? samples[i].time : delta - previousDelta);
+        previousDelta = i == 0 ? 0 : delta;
+        previous = samples[i].time;
+    }
+}
+
+void decodeTimes(const quint8 *data, const quint8 *end, quint32 count,
+                 std::vector<ArchiveSample> &samples) {
+    qint64 previous = 0;
+    qint64 previousDelta = 0;
+    for (quint32 i = 0; i < count; i++) {
+        qint64 value = readVarint(data, end);
+        qint64 time = i == 0 ? value : previous + previousDelta + value;
+        previousDelta = i == 0 ? 0 : time - previous;
+        previous = time;
+        samples[i].time = time;
+    }
+}
+
+/******************************************************************************
+* FUNCTION: encodeValues()
+*
+* DESCRIPTION: This function stores the first value raw and then the XOR with
+*              the previous value: '0' if equal, '10' and the meaningful bits
+*              if they fit in the previous leading/trailing zero window, or
+*              '11', 5 bits of leading zeros, 6 bits of length and the
+*              meaningful bits.
+*
+* PARAMETERS:  samples- the samples of the chunk.
+*              out- the encoded bytes.
+*
+* Return:      None
+******************************************************************************/
+void encodeValues(const std::vector<ArchiveSample> &samples,
+                  std::vector<quint8> &out) {
+    BitWriter writer(out);
+    quint64 previous = 0;
+    int leading = -1;
+    int trailing = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        quint64 bits = toBits(samples[i].value);
+        if (i == 0) {
+            writer.write(bits, 64);
+            previous = bits;
+            continue;
+        }
+        quint64 xored = bits ^ previous;
+        previous = bits;
+        if (xored == 0) {
+            writer.write(0, 1);
+            continue;
+        }
+        int lead = qMin(leadingZeros(xored), 31);
+        int trail = trailingZeros(xored);
+        if (leading >= 0 && lead >= leading && trail >= trailing) {
+            writer.write(2, 2);
+            writer.write(xored >> trailing, 64 - leading - trailing);
+            continue;
+        }
+        int length = 64 - lead - trail;
+        writer.write(3, 2);
+        writer.write(quint64(lead), 5);
+        writer.write(quint64(length & 63), 6);
+        writer.write(xored >> trail, length);
+        leading = lead;
+        trailing = trail;
+    }
+}
+
+void decodeValues(const quint8 *data, size_t size, quint32 count,
+                  std::vector<ArchiveSample> &samples) {
+    BitReader reader(data, size);
+    quint64 previous = 0;
+    int leading = 0;
+    int trailing = 0;
+    for (quint32 i = 0; i < count; i++) {
+        if (i == 0) {
+            previous = reader.read(64);
+        } else if (reader.read(1)) {
+            if (reader.read(1)) {
+                leading = int(reader.read(5));
+                int length = int(reader.read(6));
+                if (length == 0)
+                    length = 64;
+                trailing = 64 - leading - length;
+            }
+            previous ^= reader.read(64 - leading - trailing) << trailing;
+        }
+        samples[i].value = fromBits(previous);
+    }
+}
+
+}
+
+const char *archiveSignalName(int signal) {
+    if (signal < 0 || signal >= A_SIGNAL_COUNT)
+        return "unknown";
+    return SIGNAL_NAMES[signal];
+}
+
+int archiveSignalFromName(const std::string &name) {
+    for (int i = 0; i < A_SIGNAL_COUNT; i++) {
+        if (name == SIGNAL_NAMES[i])
+            return i;
+    }
+    return -1;
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveWriter()
+*
+* DESCRIPTION: This is the constructor of the class.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+j1939ArchiveWriter::j1939ArchiveWriter() {
+}
+
+j1939ArchiveWriter::~j1939ArchiveWriter() {
+    close();
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveWriter::open()
+*
+* DESCRIPTION: This function creates the archive file. An existing file is
+*              replaced, or with append the new blocks go after its last
+*              whole block and the index is written again on close. A file
+*              that is not an archive is never appended to nor replaced.
+*
+* PARAMETERS:  path- the archive file.
+*              append- keep the blocks of an existing archive.
+*
+* Return:      true on success.
+******************************************************************************/
+bool j1939ArchiveWriter::open(const std::string &path, bool append) {
+    close();
+    if (append) {
+        j1939ArchiveReader reader;
+        if (reader.open(path)) {
+            quint64 end = 4;
+            m_index = reader.index();
+            for (size_t i = 0; i < m_index.size(); i++)
+                end = qMax(end, m_index[i].offset + sizeof(ArchiveBlock) +
+                           m_index[i].block.timeBytes +
+                           m_index[i].block.valueBytes);
+            reader.close();
+            // drops the old index and trailer, or a partly written block
+            if (truncate(path.c_str(), off_t(end)) != 0 ||
+                    !(m_file = std::fopen(path.c_str(), "r+b")) ||
+                    std::fseek(m_file, long(end), SEEK_SET) != 0) {
+                if (m_file)
+                    std::fclose(m_file);
+                m_file = nullptr;
+                m_index.clear();
+                return false;
+            }
+            m_offset = end;
+            return true;
+        }
+        std::FILE *existing = std::fopen(path.c_str(), "rb");
+        if (existing) {
+            bool empty = std::fgetc(existing) == EOF;
+            std::fclose(existing);
+            if (!empty)
+                return false;
+        }
+    }
+
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file)
+        return false;
+    std::fwrite(ARCHIVE_FILE_MAGIC, 1, 4, m_file);
+    m_offset = 4;
+    return true;
+}
+
+bool j1939ArchiveWriter::isOpen() const {
+    return m_file != nullptr;
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveWriter::append()
+*
+* DESCRIPTION: This function adds a sample to the chunk of its signal, the
+*              chunk is written when it reaches ARCHIVE_CHUNK_SAMPLES or spans
+*              more than ARCHIVE_CHUNK_SPAN_US.
+*
+* PARAMETERS:  signal- ArchiveSignal_E of the sample.
+*              time- timestamp in microseconds.
+*              value- decoded value.
+*
+* Return:      None
+******************************************************************************/
+void j1939ArchiveWriter::append(int signal, qint64 time, double value) {
+    if (!m_file || signal < 0 || signal >= A_SIGNAL_COUNT)
+        return;
+    std::vector<ArchiveSample> &samples = m_chunks[signal].samples;
+    if (!samples.empty() &&
+            time - samples.front().time >= ARCHIVE_CHUNK_SPAN_US)
+        writeChunk(signal);
+
+    ArchiveSample sample;
+    sample.time = time;
+    sample.value = value;
+    samples.push_back(sample);
+
+    if (samples.size() >= ARCHIVE_CHUNK_SAMPLES)
+        writeChunk(signal);
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveWriter::close()
+*
+* DESCRIPTION: This function writes the pending chunks, the index and the
+*              trailer, and closes the file.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939ArchiveWriter::close() {
+    if (!m_file)
+        return;
+    for (int i = 0; i < A_SIGNAL_COUNT; i++)
+        writeChunk(i);
+
+    quint64 indexOffset = m_offset;
+    quint32 count = quint32(m_index.size());
+    quint32 magic = ARCHIVE_INDEX_MAGIC;
+    if (count)
+        std::fwrite(m_index.data(), sizeof(ArchiveIndexEntry), count, m_file);
+    std::fwrite(&indexOffset, sizeof(indexOffset), 1, m_file);
+    std::fwrite(&count, sizeof(count), 1, m_file);
+    std::fwrite(&magic, sizeof(magic), 1, m_file);
+    std::fclose(m_file);
+    m_file = nullptr;
+    m_index.clear();
+}
+
+void j1939ArchiveWriter::writeChunk(int signal) {
+    std::vector<ArchiveSample> &samples = m_chunks[signal].samples;
+    if (samples.empty())
+        return;
+
+    std::vector<quint8> times;
+    std::vector<quint8> values;
+    encodeTimes(samples, times);
+    encodeValues(samples, values);
+
+    ArchiveIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = m_offset;
+    entry.block.magic = ARCHIVE_BLOCK_MAGIC;
+    entry.block.signal = quint8(signal);
+    entry.block.count = quint32(samples.size());
+    // the ranges are kept in locals, the packed fields can't be referenced
+    qint64 minTime = samples.front().time;
+    qint64 maxTime = minTime;
+    double minValue = samples.front().value;
+    double maxValue = minValue;
+    for (size_t i = 1; i < samples.size(); i++) {
+        minTime = qMin(minTime, samples[i].time);
+        maxTime = qMax(maxTime, samples[i].time);
+        minValue = qMin(minValue, samples[i].value);
+        maxValue = qMax(maxValue, samples[i].value);
+    }
+    entry.block.minTime = minTime;
+    entry.block.maxTime = maxTime;
+    entry.block.minValue = minValue;
+    entry.block.maxValue = maxValue;
+    entry.block.timeBytes = quint32(times.size());
+    entry.block.valueBytes = quint32(values.size());
+
+    std::fwrite(&entry.block, sizeof(entry.block), 1, m_file);
+    std::fwrite(times.data(), 1, times.size(), m_file);
+    std::fwrite(values.data(), 1, values.size(), m_file);
+    std::fflush(m_file);
+    m_offset += sizeof(entry.block) + times.size() + values.size();
+    m_index.push_back(entry);
+    samples.clear();
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveReader()
+*
+* DESCRIPTION: This is the constructor of the class.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+j1939ArchiveReader::j1939ArchiveReader() {
+}
+
+j1939ArchiveReader::~j1939ArchiveReader() {
+    close();
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveReader::open()
+*
+* DESCRIPTION: This function opens an archive and loads its index, or rebuilds
+*              it from the blocks if the archive was not closed.
+*
+* PARAMETERS:  path- the archive file.
+*
+* Return:      true on success.
+******************************************************************************/
+bool j1939ArchiveReader::open(const std::string &path) {
+    close();
+    m_file = std::fopen(path.c_str(), "rb");
+    if (!m_file)
+        return false;
+    char magic[4];
+    if (std::fread(magic, 1, 4, m_file) != 4 ||
+            memcmp(magic, ARCHIVE_FILE_MAGIC, 4) != 0) {
+        close();
+        return false;
+    }
+    std::fseek(m_file, 0, SEEK_END);
+    m_size = quint64(std::ftell(m_file));
+    if (!readIndex() && !scanBlocks()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void j1939ArchiveReader::close() {
+    if (m_file)
+        std::fclose(m_file);
+    m_file = nullptr;
+    m_size = 0;
+    m_index.clear();
+}
+
+const std::vector<ArchiveIndexEntry> &j1939ArchiveReader::index() const {
+    return m_index;
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveReader::query()
+*
+* DESCRIPTION: This function returns the samples of a signal in a time range.
+*              Only the blocks whose time range overlaps the query are read.
+*
+* PARAMETERS:  signal- ArchiveSignal_E to read.
+*              from- first timestamp, inclusive.
+*              to- last timestamp, inclusive.
+*              blocksRead- optional, number of blocks read from the file.
+*
+* Return:      The samples, in file order.
+******************************************************************************/
+std::vector<ArchiveSample> j1939ArchiveReader::query(int signal, qint64 from,
+                                                     qint64 to,
+                                                     int *blocksRead) {
+    std::vector<ArchiveSample> result;
+    std::vector<ArchiveSample> samples;
+    int read = 0;
+    for (size_t i = 0; i < m_index.size(); i++) {
+        const ArchiveBlock &block = m_index[i].block;
+        if (block.signal != signal || block.maxTime < from ||
+                block.minTime > to)
+            continue;
+        if (!readBlock(m_index[i], samples))
+            continue;
+        read++;
+        for (size_t j = 0; j < samples.size(); j++) {
+            if (samples[j].time >= from && samples[j].time <= to)
+                result.push_back(samples[j]);
+        }
+    }
+    if (blocksRead)
+        *blocksRead = read;
+    return result;
+}
+
+bool j1939ArchiveReader::readIndex() {
+    quint64 indexOffset;
+    quint32 count;
+    quint32 magic;
+    const long trailer = sizeof(indexOffset) + sizeof(count) + sizeof(magic);
+
+    if (std::fseek(m_file, -trailer, SEEK_END) != 0)
+        return false;
+    long trailerOffset = std::ftell(m_file);
+    if (std::fread(&indexOffset, sizeof(indexOffset), 1, m_file) != 1 ||
+            std::fread(&count, sizeof(count), 1, m_file) != 1 ||
+            std::fread(&magic, sizeof(magic), 1, m_file) != 1 ||
+            magic != ARCHIVE_INDEX_MAGIC ||
+            indexOffset + quint64(count) * sizeof(ArchiveIndexEntry) !=
+            quint64(trailerOffset))
+        return false;
+
+    m_index.resize(count);
+    if (std::fseek(m_file, long(indexOffset), SEEK_SET) != 0 ||
+            (count && std::fread(m_index.data(), sizeof(ArchiveIndexEntry),
+                                 count, m_file) != count)) {
+        m_index.clear();
+        return false;
+    }
+    for (size_t i = 0; i < m_index.size(); i++) {
+        if (!validBlock(m_index[i])) {
+            m_index.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveReader::scanBlocks()
+*
+* DESCRIPTION: This function rebuilds the index of an archive without trailer
+*              by walking the block headers. A truncated last block is
+*              dropped.
+*
+* PARAMETERS:  None
+*
+* Return:      true if the archive holds at least the file header.
+******************************************************************************/
+bool j1939ArchiveReader::scanBlocks() {
+    m_index.clear();
+    quint64 offset = 4;
+
+    while (offset + sizeof(ArchiveBlock) <= m_size) {
+        ArchiveIndexEntry entry;
+        std::fseek(m_file, long(offset), SEEK_SET);
+        if (std::fread(&entry.block, sizeof(entry.block), 1, m_file) != 1)
+            break;
+        entry.offset = offset;
+        if (!validBlock(entry))
+            break;
+        quint64 next = offset + sizeof(entry.block) + entry.block.timeBytes +
+                entry.block.valueBytes;
+        m_index.push_back(entry);
+        offset = next;
+    }
+    return true;
+}
+
+/******************************************************************************
+* FUNCTION: j1939ArchiveReader::validBlock()
+*
+* DESCRIPTION: This function checks a block header before anything is
+*              allocated for it: at most ARCHIVE_CHUNK_SAMPLES samples, at
+*              least one timestamp byte per sample, and the whole block inside
+*              the file.
+*
+* PARAMETERS:  entry- the block and its offset.
+*
+* Return:      true if the block can be read.
+******************************************************************************/
+bool j1939ArchiveReader::validBlock(const ArchiveIndexEntry &entry) const {
+    const ArchiveBlock &block = entry.block;
+    quint64 end = entry.offset + sizeof(block) + quint64(block.timeBytes) +
+            block.valueBytes;
+    return block.magic == ARCHIVE_BLOCK_MAGIC &&
+            block.signal < A_SIGNAL_COUNT && block.count > 0 &&
+            block.count <= ARCHIVE_CHUNK_SAMPLES &&
+            block.timeBytes >= block.count && entry.offset < m_size &&
+            end <= m_size;
+}
+
+bool j1939ArchiveReader::readBlock(const ArchiveIndexEntry &entry,
+                                   std::vector<ArchiveSample> &samples) {
+    const ArchiveBlock &block = entry.block;
+    if (!validBlock(entry))
+        return false;
+    std::vector<quint8> data(block.timeBytes + block.valueBytes);
+    if (std::fseek(m_file, long(entry.offset + sizeof(ArchiveBlock)),
+                   SEEK_SET) != 0 ||
+            (!data.empty() &&
+             std::fread(data.data(), 1, data.size(), m_file) != data.size()))
+        return false;
+
+    samples.assign(block.count, ArchiveSample());
+    decodeTimes(data.data(), data.data() + block.timeBytes, block.count,
+                samples);
+    decodeValues(data.data() + block.timeBytes, block.valueBytes, block.count,
+                 samples);
+    return true;
+}
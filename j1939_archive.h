@@ -0,0 +1,141 @@
+#ifndef J1939_ARCHIVE_H
+#define J1939_ARCHIVE_H
+
+#include <QtGlobal>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "j1939_config.h"
+
+/******************************************************************************
+ *
+ * Archive of decoded signals
+ *
+ * The archive keeps the decoded values of every signal in time chunks, one
+ * column per signal. A chunk holds up to ARCHIVE_CHUNK_SAMPLES samples or
+ * ARCHIVE_CHUNK_SPAN_US of time. Timestamps are stored as zigzag varint
+ * delta-of-deltas. Values are stored as XOR of consecutive doubles, so a
+ * value that did not change costs 1 bit.
+ *
+ * File layout, little endian:
+ *
+ *   "JDA1"
+ *   block*   ArchiveBlock header, timestamp bytes, value bytes
+ *   index    one ArchiveIndexEntry per block
+ *   trailer  index offset (8), entry count (4), "JDAI"
+ *
+ * The index keeps the time and value range of every block, so a query over
+ * one signal and time range only reads the blocks it needs. If the writer
+ * did not close the file, the reader rebuilds the index by walking the
+ * blocks.
+ *
+******************************************************************************/
+
+enum ArchiveSignal_E {
+    A_TEMPERATURE,
+    A_LINEAR_DISPLACEMENT,
+    A_POSITION_X,
+    A_POSITION_Y,
+    A_ORIENTATION,
+    A_LINEAR_DTC,
+    A_TEMPERATURE_DTC,
+    A_POSITION_DTC,
+    A_SIGNAL_COUNT
+};
+
+struct ArchiveSample {
+    qint64 time;
+    double value;
+};
+
+#pragma pack(push, 1)
+struct ArchiveBlock {
+    quint32 magic;
+    quint8 signal;
+    quint8 reserved[3];
+    quint32 count;
+    qint64 minTime;
+    qint64 maxTime;
+    double minValue;
+    double maxValue;
+    quint32 timeBytes;
+    quint32 valueBytes;
+};
+
+struct ArchiveIndexEntry {
+    quint64 offset;
+    ArchiveBlock block;
+};
+#pragma pack(pop)
+
+const char *archiveSignalName(int signal);
+int archiveSignalFromName(const std::string &name);
+
+/******************************************************************************
+ *
+ * Class: j1939ArchiveWriter
+ *
+ * This class appends samples to the chunk of their signal and writes the
+ * chunk as a block when it is full. close() writes the pending chunks and
+ * the index. An existing archive is either replaced or continued, keeping
+ * its blocks.
+ *
+******************************************************************************/
+
+class j1939ArchiveWriter {
+public:
+    j1939ArchiveWriter();
+    ~j1939ArchiveWriter();
+
+    bool open(const std::string &path, bool append = false);
+    void append(int signal, qint64 time, double value);
+    void close();
+    bool isOpen() const;
+
+private:
+    struct Chunk {
+        std::vector<ArchiveSample> samples;
+    };
+
+    void writeChunk(int signal);
+
+    std::FILE *m_file = nullptr;
+    quint64 m_offset = 0;
+    Chunk m_chunks[A_SIGNAL_COUNT];
+    std::vector<ArchiveIndexEntry> m_index;
+};
+
+/******************************************************************************
+ *
+ * Class: j1939ArchiveReader
+ *
+ * This class reads the index of an archive and decodes the blocks that
+ * overlap a query.
+ *
+******************************************************************************/
+
+class j1939ArchiveReader {
+public:
+    j1939ArchiveReader();
+    ~j1939ArchiveReader();
+
+    bool open(const std::string &path);
+    void close();
+
+    const std::vector<ArchiveIndexEntry> &index() const;
+    std::vector<ArchiveSample> query(int signal, qint64 from, qint64 to,
+                                     int *blocksRead = nullptr);
+
+private:
+    bool readIndex();
+    bool scanBlocks();
+    bool validBlock(const ArchiveIndexEntry &entry) const;
+    bool readBlock(const ArchiveIndexEntry &entry,
+                   std::vector<ArchiveSample> &samples);
+
+    std::FILE *m_file = nullptr;
+    quint64 m_size = 0;
+    std::vector<ArchiveIndexEntry> m_index;
+};
+
+#endif // J1939_ARCHIVE_H
@@ -0,0 +1,334 @@
+#include "j1939_batch.h"
+#include <QtEndian>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define J1939_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define J1939_NEON
+#endif
+
+namespace {
+
+// a 16 bit field is msb, lsb; a byte field has lsb -1
+struct Field {
+    int group;
+    int signal;
+    int msb;
+    int lsb;
+    double divisor;
+    double offset;
+};
+
+const Field FIELDS[] = {
+    {j1939BatchDecoder::G_LINEAR_DISPLACEMENT, A_LINEAR_DISPLACEMENT,
+     LINEAR_DISPLACEMENT_MSB, LINEAR_DISPLACEMENT_LSB,
+     LINEAR_DISPLACEMENT_CONSTANT, 0},
+    {j1939BatchDecoder::G_ENGINE_TEMPERATURE, A_TEMPERATURE,
+     ENGINE_TEMPERATURE_B, -1, 1, -ENGINE_TEMPERATURE_OFFSET},
+    {j1939BatchDecoder::G_VEHICLE_POSITION, A_POSITION_X,
+     VEHICLE_POSITION_X_MSB, VEHICLE_POSITION_X_LSB, 1, 0},
+    {j1939BatchDecoder::G_VEHICLE_POSITION, A_POSITION_Y,
+     VEHICLE_POSITION_Y_MSB, VEHICLE_POSITION_Y_LSB, 1, 0},
+    {j1939BatchDecoder::G_VEHICLE_ORIENTATION, A_ORIENTATION,
+     VEHICLE_ORIENTATION_X_MSB, VEHICLE_ORIENTATION_X_LSB,
+     ORIENTATION_DEGREES_CONSTANT, 0}
+};
+
+const quint32 GROUP_PGN[j1939BatchDecoder::G_COUNT] = {
+    LINEAR_DISPLACEMENT_PGN,
+    ENGINE_TEMPERATURE_PGN,
+    VEHICLE_POSITION_PGN,
+    VEHICLE_ORIENTATION_PGN
+};
+
+// shortest payload of each group, as checked by j1939Decode()
+const int GROUP_LENGTH[j1939BatchDecoder::G_COUNT + 1] = {
+    LINEAR_DISPLACEMENT_LSB + 1,
+    ENGINE_TEMPERATURE_B + 1,
+    VEHICLE_POSITION_Y_LSB + 1,
+    VEHICLE_ORIENTATION_X_LSB + 1,
+    0
+};
+
+inline quint32 byteAt(quint32 word, int byte) {
+    return (word >> (8 * byte)) & 0xFF;
+}
+
+/******************************************************************************
+* FUNCTION: extractHeaders()
+*
+* DESCRIPTION: This function splits the CAN ids of a batch in PGN and source
+*              address and finds the group of each PGN, 4 ids at a time with
+*              SIMD. The PGNs of the groups are distinct, so at most one
+*              compare matches.
+*
+* PARAMETERS:  ids- the CAN ids.
+*              count- the number of ids.
+*              pgn- the PGN of every id.
+*              source- the source address of every id.
+*              group- the Group_E of every id.
+*
+* Return:      None
+******************************************************************************/
+void extractHeaders(const quint32 *ids, std::size_t count, quint32 *pgn,
+                    quint32 *source, quint32 *group) {
+    std::size_t i = 0;
+#if defined(J1939_SSE2)
+    const __m128i pgnMask = _mm_set1_epi32(int(PGN_MASK));
+    const __m128i adrMask = _mm_set1_epi32(ADR_MASK);
+    for (; i + 4 <= count; i += 4) {
+        __m128i id = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(ids + i));
+        __m128i PGN = _mm_srli_epi32(_mm_and_si128(id, pgnMask),
+                                     PGN_SHIFT_POSITION);
+        __m128i groups = _mm_set1_epi32(j1939BatchDecoder::G_COUNT);
+        for (int g = 0; g < j1939BatchDecoder::G_COUNT; g++) {
+            __m128i match = _mm_cmpeq_epi32(
+                        PGN, _mm_set1_epi32(int(GROUP_PGN[g])));
+            groups = _mm_or_si128(_mm_and_si128(match, _mm_set1_epi32(g)),
+                                  _mm_andnot_si128(match, groups));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pgn + i), PGN);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(source + i),
+                         _mm_and_si128(id, adrMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(group + i), groups);
+    }
+#elif defined(J1939_NEON)
+    const uint32x4_t pgnMask = vdupq_n_u32(PGN_MASK);
+    const uint32x4_t adrMask = vdupq_n_u32(ADR_MASK);
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t id = vld1q_u32(ids + i);
+        uint32x4_t PGN = vshrq_n_u32(vandq_u32(id, pgnMask),
+                                     PGN_SHIFT_POSITION);
+        uint32x4_t groups = vdupq_n_u32(j1939BatchDecoder::G_COUNT);
+        for (int g = 0; g < j1939BatchDecoder::G_COUNT; g++)
+            groups = vbslq_u32(vceqq_u32(PGN, vdupq_n_u32(GROUP_PGN[g])),
+                               vdupq_n_u32(g), groups);
+        vst1q_u32(pgn + i, PGN);
+        vst1q_u32(source + i, vandq_u32(id, adrMask));
+        vst1q_u32(group + i, groups);
+    }
+#endif
+    for (; i < count; i++) {
+        pgn[i] = (ids[i] & PGN_MASK) >> PGN_SHIFT_POSITION;
+        source[i] = ids[i] & ADR_MASK;
+        group[i] = j1939BatchDecoder::G_COUNT;
+        for (int g = 0; g < j1939BatchDecoder::G_COUNT; g++) {
+            if (pgn[i] == GROUP_PGN[g])
+                group[i] = quint32(g);
+        }
+    }
+}
+
+/******************************************************************************
+* FUNCTION: extractField()
+*
+* DESCRIPTION: This function extracts a big endian field from the first 4
+*              payload bytes of a group of frames, 4 frames at a time with
+*              SIMD.
+*
+* PARAMETERS:  words- the first 4 payload bytes of every frame, little endian.
+*              count- the number of frames.
+*              msb- the byte of the field, or of its most significant byte.
+*              lsb- the least significant byte, -1 for a byte field.
+*              raw- the field of every frame.
+*
+* Return:      None
+******************************************************************************/
+void extractField(const quint32 *words, std::size_t count, int msb, int lsb,
+                  quint32 *raw) {
+    std::size_t i = 0;
+#if defined(J1939_SSE2)
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i msbShift = _mm_cvtsi32_si128(8 * msb);
+    const __m128i lsbShift = _mm_cvtsi32_si128(8 * (lsb < 0 ? 0 : lsb));
+    for (; i + 4 <= count; i += 4) {
+        __m128i word = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(words + i));
+        __m128i field = _mm_and_si128(_mm_srl_epi32(word, msbShift),
+                                      byteMask);
+        if (lsb >= 0)
+            field = _mm_or_si128(_mm_slli_epi32(field, MSB_SHIFT_POSITION),
+                                 _mm_and_si128(_mm_srl_epi32(word, lsbShift),
+                                               byteMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(raw + i), field);
+    }
+#elif defined(J1939_NEON)
+    const uint32x4_t byteMask = vdupq_n_u32(0xFF);
+    const int32x4_t msbShift = vdupq_n_s32(-8 * msb);
+    const int32x4_t lsbShift = vdupq_n_s32(-8 * (lsb < 0 ? 0 : lsb));
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t word = vld1q_u32(words + i);
+        uint32x4_t field = vandq_u32(vshlq_u32(word, msbShift), byteMask);
+        if (lsb >= 0)
+            field = vorrq_u32(vshlq_n_u32(field, MSB_SHIFT_POSITION),
+                              vandq_u32(vshlq_u32(word, lsbShift), byteMask));
+        vst1q_u32(raw + i, field);
+    }
+#endif
+    for (; i < count; i++) {
+        raw[i] = byteAt(words[i], msb);
+        if (lsb >= 0)
+            raw[i] = raw[i] << MSB_SHIFT_POSITION | byteAt(words[i], lsb);
+    }
+}
+
+/******************************************************************************
+* FUNCTION: scaleField()
+*
+* DESCRIPTION: This function converts raw fields to values, raw / divisor +
+*              offset, 4 fields at a time with SIMD where doubles are
+*              supported. The order of the operations gives the same result
+*              as j1939Decode().
+*
+* PARAMETERS:  raw- the raw fields, up to 16 bits.
+*              count- the number of fields.
+*              divisor- the resolution divisor of the signal.
+*              offset- the offset of the signal.
+*              values- the values.
+*
+* Return:      None
+******************************************************************************/
+void scaleField(const quint32 *raw, std::size_t count, double divisor,
+                double offset, double *values) {
+    std::size_t i = 0;
+#if defined(J1939_SSE2)
+    const __m128d divisors = _mm_set1_pd(divisor);
+    const __m128d offsets = _mm_set1_pd(offset);
+    for (; i + 4 <= count; i += 4) {
+        __m128i field = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(raw + i));
+        __m128d low = _mm_cvtepi32_pd(field);
+        __m128d high = _mm_cvtepi32_pd(
+                    _mm_shuffle_epi32(field, _MM_SHUFFLE(3, 2, 3, 2)));
+        _mm_storeu_pd(values + i,
+                      _mm_add_pd(_mm_div_pd(low, divisors), offsets));
+        _mm_storeu_pd(values + i + 2,
+                      _mm_add_pd(_mm_div_pd(high, divisors), offsets));
+    }
+#elif defined(J1939_NEON) && defined(__aarch64__)
+    const float64x2_t divisors = vdupq_n_f64(divisor);
+    const float64x2_t offsets = vdupq_n_f64(offset);
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t field = vld1q_u32(raw + i);
+        float64x2_t low = vcvtq_f64_u64(vmovl_u32(vget_low_u32(field)));
+        float64x2_t high = vcvtq_f64_u64(vmovl_u32(vget_high_u32(field)));
+        vst1q_f64(values + i, vaddq_f64(vdivq_f64(low, divisors), offsets));
+        vst1q_f64(values + i + 2,
+                  vaddq_f64(vdivq_f64(high, divisors), offsets));
+    }
+#endif
+    for (; i < count; i++)
+        values[i] = raw[i] / divisor + offset;
+}
+
+}
+
+/******************************************************************************
+* FUNCTION: j1939BatchDecoder()
+*
+* DESCRIPTION: This is the constructor of the class.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+j1939BatchDecoder::j1939BatchDecoder() {
+}
+
+/******************************************************************************
+* FUNCTION: j1939BatchDecoder::decode()
+*
+* DESCRIPTION: This function decodes a batch of frames into the columns of
+*              the signals, replacing the previous batch. Frames of other
+*              PGNs, or too short for their PGN, are skipped.
+*
+* PARAMETERS:  ids- the CAN ids.
+*              payloads- count payloads of BYTE_DATA_PER_PACKET bytes.
+*              lengths- the payload lengths, nullptr if all are full.
+*              times- the reception times, in us.
+*              count- the number of frames.
+*
+* Return:      None
+******************************************************************************/
+void j1939BatchDecoder::decode(const quint32 *ids, const quint8 *payloads,
+                               const quint8 *lengths, const qint64 *times,
+                               std::size_t count) {
+    m_pgn.resize(count);
+    m_source.resize(count);
+    m_group.resize(count);
+    extractHeaders(ids, count, m_pgn.data(), m_source.data(), m_group.data());
+
+    // counting sort by group, frames too short for their PGN are left out
+    std::size_t counts[G_COUNT + 1] = {};
+    for (std::size_t i = 0; i < count; i++) {
+        quint32 group = m_group[i];
+        if (lengths && lengths[i] < GROUP_LENGTH[group])
+            group = m_group[i] = G_COUNT;
+        counts[group]++;
+    }
+    std::size_t position[G_COUNT + 1];
+    m_start[0] = 0;
+    for (int g = 0; g <= G_COUNT; g++) {
+        position[g] = m_start[g];
+        m_start[g + 1] = m_start[g] + counts[g];
+    }
+    m_frames.resize(count);
+    m_words.resize(count);
+    for (std::size_t i = 0; i < count; i++) {
+        std::size_t sorted = position[m_group[i]]++;
+        m_frames[sorted] = quint32(i);
+        m_words[sorted] = qFromLittleEndian<quint32>(
+                    payloads + i * BYTE_DATA_PER_PACKET);
+    }
+
+    for (int i = 0; i < A_SIGNAL_COUNT; i++) {
+        m_columns[i].time.clear();
+        m_columns[i].value.clear();
+        m_columns[i].source.clear();
+    }
+    for (const Field &field : FIELDS) {
+        std::size_t first = m_start[field.group];
+        std::size_t samples = m_start[field.group + 1] - first;
+        j1939SampleColumns &column = m_columns[field.signal];
+        m_raw.resize(samples);
+        column.value.resize(samples);
+        column.time.resize(samples);
+        column.source.resize(samples);
+
+        extractField(m_words.data() + first, samples, field.msb, field.lsb,
+                     m_raw.data());
+        scaleField(m_raw.data(), samples, field.divisor, field.offset,
+                   column.value.data());
+        for (std::size_t k = 0; k < samples; k++) {
+            quint32 frame = m_frames[first + k];
+            column.time[k] = times[frame];
+            column.source[k] = quint8(m_source[frame]);
+        }
+    }
+}
+
+const j1939SampleColumns &j1939BatchDecoder::columns(int signal) const {
+    return m_columns[signal];
+}
+
+const char *j1939BatchDecoder::instructionSet() {
+#if defined(J1939_SSE2)
+    return "SSE2";
+#elif defined(J1939_NEON) && defined(__aarch64__)
+    return "NEON";
+#elif defined(J1939_NEON)
+    return "NEON, scalar doubles";
+#else
+    return "scalar";
+#endif
+}
+
+std::size_t j1939BatchDecoder::samples() const {
+    std::size_t samples = 0;
+    for (int i = 0; i < A_SIGNAL_COUNT; i++)
+        samples += m_columns[i].value.size();
+    return samples;
+}
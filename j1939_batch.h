@@ -0,0 +1,71 @@
+#ifndef J1939_BATCH_H
+#define J1939_BATCH_H
+
+#include <QtGlobal>
+#include <cstddef>
+#include <vector>
+#include "j1939_config.h"
+#include "j1939_archive.h"
+
+/******************************************************************************
+ *
+ * Class: j1939BatchDecoder
+ *
+ * Batch version of j1939Decode() for offline logs and bulk replay. Frames
+ * are given as arrays: CAN ids, 8 byte payloads, payload lengths and
+ * reception times. The decode runs in passes over the whole batch:
+ *
+ *   1. PGN and source address of every frame, with PGN_MASK and ADR_MASK,
+ *      and the group of its PGN
+ *   2. frames of the measurement PGNs sorted by group with a counting sort,
+ *      keeping the first 4 payload bytes, where all of their fields are
+ *   3. big endian extraction of each field over its group
+ *   4. scale and offset of each field over its group
+ *
+ * Passes 1, 3 and 4 use SSE2 or NEON when available. Batches of a few
+ * thousand frames keep the passes in cache. The result is one
+ * column per signal (times, values, source addresses) in frame order, with
+ * the same values j1939Decode() gives frame by frame. The buffers are kept
+ * between batches.
+ *
+******************************************************************************/
+
+struct j1939SampleColumns {
+    std::vector<qint64> time;
+    std::vector<double> value;
+    std::vector<quint8> source;
+};
+
+class j1939BatchDecoder {
+public:
+    // frames of one measurement PGN, G_COUNT for the rest
+    enum Group_E {
+        G_LINEAR_DISPLACEMENT,
+        G_ENGINE_TEMPERATURE,
+        G_VEHICLE_POSITION,
+        G_VEHICLE_ORIENTATION,
+        G_COUNT
+    };
+
+    j1939BatchDecoder();
+
+    void decode(const quint32 *ids, const quint8 *payloads,
+                const quint8 *lengths, const qint64 *times,
+                std::size_t count);
+    const j1939SampleColumns &columns(int signal) const;
+    std::size_t samples() const;
+    static const char *instructionSet();
+
+private:
+    std::vector<quint32> m_pgn;
+    std::vector<quint32> m_source;
+    std::vector<quint32> m_group;
+    // frames sorted by group, group g is [m_start[g], m_start[g + 1])
+    std::vector<quint32> m_frames;
+    std::vector<quint32> m_words;
+    std::size_t m_start[G_COUNT + 2];
+    std::vector<quint32> m_raw;
+    j1939SampleColumns m_columns[A_SIGNAL_COUNT];
+};
+
+#endif // J1939_BATCH_H
@@ -0,0 +1,196 @@
+#ifndef J1939_BUS_H
+#define J1939_BUS_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include "j1939_config.h"
+#include "j1939_decoder.h"
+
+/******************************************************************************
+ *
+ * Class: j1939Ring
+ *
+ * Broadcast ring with one producer and any number of readers. The producer
+ * never waits: publish() overwrites the oldest value. Readers keep their own
+ * position and never write to the ring, so they do not slow down the
+ * producer nor each other.
+ *
+ * Every slot carries a sequence number, odd while the slot is written and
+ * 2 * (position + 1) once the value of position is in it. A reader copies
+ * the value and checks the sequence did not change meanwhile; if it did,
+ * the producer lapped the reader. Values are copied as relaxed atomic
+ * words, so T must be trivially copyable.
+ *
+******************************************************************************/
+
+template <typename T, std::size_t Size>
+class j1939Ring {
+    static_assert(Size && !(Size & (Size - 1)), "Size must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T must be trivially copyable");
+
+public:
+    j1939Ring() {
+        for (std::size_t i = 0; i < Size; i++)
+            m_slots[i].sequence.store(0, std::memory_order_relaxed);
+        m_head.store(0, std::memory_order_relaxed);
+    }
+
+    void publish(const T &value) {
+        quint64 position = m_head.load(std::memory_order_relaxed);
+        Slot &slot = m_slots[position & (Size - 1)];
+        quint64 words[WORDS] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        slot.sequence.store(2 * position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i = 0; i < WORDS; i++)
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        slot.sequence.store(2 * position + 2, std::memory_order_release);
+        m_head.store(position + 1, std::memory_order_release);
+    }
+
+    // number of values published so far
+    quint64 head() const {
+        return m_head.load(std::memory_order_acquire);
+    }
+
+    // false if position was not published yet or was overwritten
+    bool read(quint64 position, T &value) const {
+        const Slot &slot = m_slots[position & (Size - 1)];
+        quint64 sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * position + 2)
+            return false;
+        quint64 words[WORDS];
+        for (std::size_t i = 0; i < WORDS; i++)
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+            return false;
+        std::memcpy(&value, words, sizeof(T));
+        return true;
+    }
+
+    static std::size_t capacity() {
+        return Size;
+    }
+
+private:
+    static const std::size_t WORDS = (sizeof(T) + 7) / 8;
+
+    struct Slot {
+        std::atomic<quint64> sequence;
+        std::atomic<quint64> words[WORDS];
+    };
+
+    Slot m_slots[Size];
+    // keeps m_head off the cache line of the last slot, padded rather than
+    // alignas(64), which operator new does not honour before C++17
+    char m_padding[64];
+    std::atomic<quint64> m_head;
+};
+
+/******************************************************************************
+ *
+ * Class: j1939SignalBus
+ *
+ * Decoded samples, one j1939Ring per ArchiveSignal_E. Every signal must be
+ * published from a single thread: the measurement signals by the thread that
+ * decodes the frames, the DTC signals by the thread of the j1939 object.
+ * Consumers read it through j1939Subscriber, from any thread.
+ *
+******************************************************************************/
+
+class j1939SignalBus {
+public:
+    typedef j1939Ring<j1939Sample, BUS_RING_SIZE> Ring;
+
+    void publish(const j1939Sample &sample) {
+        if (sample.signal < A_SIGNAL_COUNT)
+            m_rings[sample.signal].publish(sample);
+    }
+
+    // newest sample of a signal, false if none was published
+    bool latest(int signal, j1939Sample &sample) const {
+        const Ring &ring = m_rings[signal];
+        for (;;) {
+            quint64 head = ring.head();
+            if (!head)
+                return false;
+            if (ring.read(head - 1, sample))
+                return true;
+        }
+    }
+
+    const Ring &ring(int signal) const {
+        return m_rings[signal];
+    }
+
+private:
+    Ring m_rings[A_SIGNAL_COUNT];
+};
+
+/******************************************************************************
+ *
+ * Class: j1939Subscriber
+ *
+ * Position of one consumer in the ring of a signal. next() gives every
+ * sample in order, last() skips to the newest one. A consumer slower than
+ * the producer loses the overwritten samples, they are counted in lost().
+ * A subscriber belongs to one thread, any number of them can read the same
+ * signal.
+ *
+******************************************************************************/
+
+class j1939Subscriber {
+public:
+    j1939Subscriber(const j1939SignalBus *bus, int signal,
+                    bool backlog = false)
+        : m_ring(&bus->ring(signal)) {
+        quint64 head = m_ring->head();
+        m_position = head;
+        if (backlog)
+            m_position = head > m_ring->capacity() ? head - m_ring->capacity()
+                                                   : 0;
+    }
+
+    bool next(j1939Sample &sample) {
+        for (;;) {
+            quint64 head = m_ring->head();
+            if (m_position >= head)
+                return false;
+            if (head - m_position > m_ring->capacity()) {
+                m_lost += head - m_position - m_ring->capacity();
+                m_position = head - m_ring->capacity();
+            }
+            if (m_ring->read(m_position++, sample))
+                return true;
+            m_lost++;
+        }
+    }
+
+    bool last(j1939Sample &sample) {
+        for (;;) {
+            quint64 head = m_ring->head();
+            if (m_position >= head)
+                return false;
+            m_position = head;
+            if (m_ring->read(head - 1, sample))
+                return true;
+        }
+    }
+
+    quint64 lost() const {
+        return m_lost;
+    }
+
+private:
+    const j1939SignalBus::Ring *m_ring;
+    quint64 m_position = 0;
+    quint64 m_lost = 0;
+};
+
+#endif // J1939_BUS_H
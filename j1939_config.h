@@ -7,6 +7,26 @@
 #ifndef J1939_CONFIG_H
 #define J1939_CONFIG_H
 
+/******************************************************************************
+ *
+ * CAN interface, brought up by j1939Link at startup.
+ *
+******************************************************************************/
+
+#define CAN_INTERFACE                    "can0"
+#define CAN_INTERFACE_ENV                "JD_CAN_INTERFACE"
+#define CAN_BITRATE                      500000
+#define LINK_UP_RETRIES                  20
+#define LINK_UP_RETRY_MS                 50
+
+// Reconnect after bus-off or device errors, see j1939Recovery
+#define RECONNECT_BACKOFF_MIN_MS         100
+#define RECONNECT_BACKOFF_MAX_MS         5000
+#define ERROR_CONTROLLER_BYTE            1
+#define ERROR_OVERFLOW_MASK              0x03
+
+/*****************************************************************************/
+
 #define ID_PRIORITY_MASK                 0x1C000000
 #define EXTENDED_DATA_MASK               0x02000000
 #define DATA_PAGE_MASK                   0x01000000
@@ -37,6 +57,14 @@
 //PGN65226 DM1 - Active Diagnostic Trouble Codes:
 #define DM1_PGN                          0xFECA
 
+//PGN59904 Request and the services used to answer it:
+#define REQUEST_PGN                      0xEA00
+#define ACK_PGN                          0xE800
+#define TP_CM_PGN                        0xEC00
+#define TP_DT_PGN                        0xEB00
+#define SOFTWARE_ID_PGN                  0xFEDA
+#define COMPONENT_ID_PGN                 0xFEEB
+
 /******************************************************************************
  *
  * Byte placement for data reception and transmission.
@@ -55,6 +83,11 @@
 #define VEHICLE_ORIENTATION_X_LSB         2
 #define VEHICLE_ORIENTATION_X_MSB         1
 
+// Conversion between byte array values and actual values
+#define LINEAR_DISPLACEMENT_CONSTANT      10
+#define ENGINE_TEMPERATURE_OFFSET         40
+#define ORIENTATION_DEGREES_CONSTANT      128
+
 // Transmit:
 #define HEATER_SETPOINT_BYTE              0
 #define TREAD_POS_BYTE8                   4
@@ -75,6 +108,7 @@
 
 #define DM2_PGN                           0xFECB
 #define DM3_PGN                           0xFECC
+#define DM11_PGN                          0xFED3
 #define DM4_TEST_PGN                      0xFFF0
 
 #define FUEL_GAUGE_DTC                    0xBEBA
@@ -87,10 +121,122 @@
 #define BYTE_DATA_PER_PACKET              0x08
 #define EMPTY_PAYLOAD                     0x00
 #define ECU_PRIORITY_LEVEL                0x06
+#define CONTROL_PRIORITY_LEVEL            0x03
 #define EXTENDED_DATA_BIT                 0x00
 #define DATA_PAGE_BIT                     0x00
 #define ECU_SOURCE_ADDRESS                0x01
 #define FMI_POS                           0x04
+#define GLOBAL_ADR                        0xFF
+#define PDU2_FORMAT_BOUNDARY              0xF0
+
+/******************************************************************************
+ *
+ * Request PGN responder. Identification strings are '*' delimited as
+ * required by PGN 65242 and PGN 65259.
+ *
+******************************************************************************/
+
+#define SOFTWARE_ID_STRING                "JDInterfaz*1.0*"
+#define COMPONENT_ID_STRING               "TEC*JDInterfaz*0001*Dashboard*"
+
+#define REQUEST_PGN_LENGTH                3
+#define DTC_LENGTH                        4
+#define DTC_POS                           2
+#define DM_LAMP_NO_FAULTS                 0x00
+#define DM_LAMP_AMBER_WARNING             0x04
+#define DM_LAMP_RESERVED                  0xFF
+
+#define ACK_CONTROL_NACK                  0x01
+#define TP_CM_BAM                         0x20
+#define TP_BYTES_PER_PACKET               0x07
+#define TP_BAM_PACKET_INTERVAL_MS         50
+#define TP_MAX_MESSAGE_SIZE               1785
+
+/******************************************************************************
+ *
+ * Diagnostic client, requests DM2 and clears DTCs with DM3/DM11 on the
+ * devices. Timeout covers the response time plus a full TP session.
+ *
+******************************************************************************/
+
+#define ACK_CONTROL_ACK                   0x00
+#define TP_CM_RTS                         0x10
+#define TP_CM_CTS                         0x11
+#define TP_CM_EOMA                        0x13
+#define TP_CM_ABORT                       0xFF
+#define DIAG_RESPONSE_TIMEOUT_MS          1250
+#define SPN_MSB_SHIFT_POSITION            5
+#define SPN_MSB_MASK                      0xE0
+#define OC_MASK                           0x7F
+
+/******************************************************************************
+ *
+ * Transmit scheduler. One queue per J1939 priority, frames with priority up
+ * to TX_UNSHAPED_PRIORITY are never delayed by the bus load shaping.
+ *
+******************************************************************************/
+
+#define TX_PRIORITY_LEVELS                8
+#define TX_QUEUE_DEPTH                    256
+#define TX_BATCH_SIZE                     16
+#define TX_DEVICE_BACKLOG                 32
+#define TX_UNSHAPED_PRIORITY              2
+#define TX_BUS_BITRATE                    CAN_BITRATE
+#define TX_BUS_LOAD_CEILING_PCT           30
+#define TX_BURST_FRAMES                   8
+
+/******************************************************************************
+ *
+ * Signal archive, written when JD_ARCHIVE holds the path of the archive. An
+ * existing archive is continued, every run adds its blocks.
+ *
+******************************************************************************/
+
+#define ARCHIVE_ENV                       "JD_ARCHIVE"
+#define ARCHIVE_FILE_MAGIC                "JDA1"
+#define ARCHIVE_BLOCK_MAGIC               0x4241444A
+#define ARCHIVE_INDEX_MAGIC               0x4941444A
+#define ARCHIVE_CHUNK_SAMPLES             1024
+#define ARCHIVE_CHUNK_SPAN_US             60000000LL
+
+/******************************************************************************
+ *
+ * Real-time receive profile, opt-in with JD_RT_PROFILE=1. The receive and
+ * decode thread runs with SCHED_FIFO at RT_PRIORITY, pinned to JD_RT_CPU
+ * when it is set, with all memory locked.
+ *
+******************************************************************************/
+
+#define RT_PROFILE_ENV                    "JD_RT_PROFILE"
+#define RT_CPU_ENV                        "JD_RT_CPU"
+#define RT_PRIORITY_ENV                   "JD_RT_PRIORITY"
+#define RT_PRIORITY                       80
+#define RT_PREFAULT_STACK                 (256 * 1024)
+#define RT_POLL_MS                        100
+#define RT_REOPEN_MS                      100
+#define RT_SENT_FRAMES                    256
+#define LATENCY_BUCKETS                   24
+#define DECODE_MAX_SAMPLES                2
+
+// Signal bus, samples kept per signal and display refresh with the receiver
+#define BUS_RING_SIZE                     1024
+#define BUS_POLL_MS                       16
+
+/******************************************************************************
+ *
+ * Warm-start snapshot, kept when JD_SNAPSHOT holds its path. It is written
+ * SNAPSHOT_PERIOD_MS after a setpoint, fault or DTC change. Changes of the
+ * gauge values alone are written every SNAPSHOT_VALUES_MS, to spare the SD
+ * card while traffic flows.
+ *
+******************************************************************************/
+
+#define SNAPSHOT_ENV                      "JD_SNAPSHOT"
+#define SNAPSHOT_MAGIC                    "JDS1"
+#define SNAPSHOT_VERSION                  1
+#define SNAPSHOT_PERIOD_MS                1000
+#define SNAPSHOT_VALUES_MS                60000
+#define SNAPSHOT_ADDRESS_BYTES            32
 
 #define PRIORITY_SHIFT_POSITION           26
 #define EXTENDED_DATA_SHIFT_POSITION      25
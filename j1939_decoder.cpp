@@ -0,0 +1,74 @@
+#include "j1939_decoder.h"
+
+namespace {
+
+inline uint word(const quint8 *data, int msb, int lsb) {
+    return uint(data[msb]) << MSB_SHIFT_POSITION | uint(data[lsb]);
+}
+
+inline void sample(j1939Sample &sample, quint8 signal, quint8 source,
+                   qint64 time, double value) {
+    sample.time = time;
+    sample.value = value;
+    sample.signal = signal;
+    sample.source = source;
+}
+
+}
+
+/******************************************************************************
+* FUNCTION: j1939Decode()
+*
+* DESCRIPTION: This function decodes the values carried by a measurement
+*              frame. Frames of other PGNs, or too short for their PGN, give
+*              no samples.
+*
+* PARAMETERS:  canId- the id segment of the can frame.
+*              data- the payload of the frame.
+*              length- the length of the payload.
+*              time- the reception time of the frame, in us.
+*              samples- room for DECODE_MAX_SAMPLES samples.
+*
+* Return:      The number of samples written.
+******************************************************************************/
+int j1939Decode(quint32 canId, const quint8 *data, int length, qint64 time,
+                j1939Sample *samples) {
+    quint8 source = quint8(canId & SOURCE_ADRESS_MASK);
+
+    switch ((canId & PGN_MASK) >> PGN_SHIFT_POSITION) {
+    case LINEAR_DISPLACEMENT_PGN:
+        if (length <= LINEAR_DISPLACEMENT_LSB)
+            return 0;
+        sample(samples[0], A_LINEAR_DISPLACEMENT, source, time,
+               int(word(data, LINEAR_DISPLACEMENT_MSB,
+                        LINEAR_DISPLACEMENT_LSB)) /
+               double(LINEAR_DISPLACEMENT_CONSTANT));
+        return 1;
+
+    case ENGINE_TEMPERATURE_PGN:
+        if (length <= ENGINE_TEMPERATURE_B)
+            return 0;
+        sample(samples[0], A_TEMPERATURE, source, time,
+               int(data[ENGINE_TEMPERATURE_B]) - ENGINE_TEMPERATURE_OFFSET);
+        return 1;
+
+    case VEHICLE_POSITION_PGN:
+        if (length <= VEHICLE_POSITION_Y_LSB)
+            return 0;
+        sample(samples[0], A_POSITION_X, source, time,
+               word(data, VEHICLE_POSITION_X_MSB, VEHICLE_POSITION_X_LSB));
+        sample(samples[1], A_POSITION_Y, source, time,
+               word(data, VEHICLE_POSITION_Y_MSB, VEHICLE_POSITION_Y_LSB));
+        return 2;
+
+    case VEHICLE_ORIENTATION_PGN:
+        if (length <= VEHICLE_ORIENTATION_X_LSB)
+            return 0;
+        sample(samples[0], A_ORIENTATION, source, time,
+               int(word(data, VEHICLE_ORIENTATION_X_MSB,
+                        VEHICLE_ORIENTATION_X_LSB)) /
+               double(ORIENTATION_DEGREES_CONSTANT));
+        return 1;
+    }
+    return 0;
+}
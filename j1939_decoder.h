@@ -0,0 +1,30 @@
+#ifndef J1939_DECODER_H
+#define J1939_DECODER_H
+
+#include <QtGlobal>
+#include "j1939_config.h"
+#include "j1939_archive.h"
+
+/******************************************************************************
+ *
+ * Decoder of the measurement PGNs
+ *
+ * j1939Decode() turns the frames of LINEAR_DISPLACEMENT_PGN,
+ * ENGINE_TEMPERATURE_PGN, VEHICLE_POSITION_PGN and VEHICLE_ORIENTATION_PGN
+ * into samples, one per signal. Signals are identified by ArchiveSignal_E.
+ * It does not allocate nor touch shared state, so it can run on the
+ * real-time receive thread as well as in j1939::processFrames().
+ *
+******************************************************************************/
+
+struct j1939Sample {
+    qint64 time;
+    double value;
+    quint8 signal;
+    quint8 source;
+};
+
+int j1939Decode(quint32 canId, const quint8 *data, int length, qint64 time,
+                j1939Sample *samples);
+
+#endif // J1939_DECODER_H
@@ -0,0 +1,358 @@
+#include "j1939_diagnostics.h"
+#include "j1939.h"
+#include <QTimer>
+#include <QVariantMap>
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics()
+*
+* DESCRIPTION: This is the constructor of the class.
+*
+* PARAMETERS:  bus- the j1939 instance used to build the request frames.
+*
+* Return:      None
+******************************************************************************/
+j1939Diagnostics::j1939Diagnostics(j1939 *bus, QObject *parent)
+    : QObject(parent), m_bus(bus) {
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::request()
+*
+* DESCRIPTION: This function sends a Request PGN to a device and returns
+*              without waiting. If the same PGN is already being waited on
+*              that device, no new frame is sent and the request joins it.
+*              A global request is refused, its responses can't be told
+*              apart per device.
+*
+* PARAMETERS:  address- the device address, not GLOBAL_ADR.
+*              PGN- the requested PGN.
+*              timeout- time in ms to wait for the response.
+*
+* Return:      The id that identifies the request in the result signals,
+*              -1 if it was refused.
+******************************************************************************/
+int j1939Diagnostics::request(quint8 address, quint32 PGN, int timeout) {
+    if (address == GLOBAL_ADR)
+        return -1;
+
+    int id = m_nextId++;
+    quint64 k = key(address, PGN);
+
+    if (!m_pending.contains(k)) {
+        Pending pending;
+        pending.address = address;
+        pending.PGN = PGN;
+        m_pending.insert(k, pending);
+
+        QByteArray payload(REQUEST_PGN_LENGTH, EMPTY_PAYLOAD);
+        payload[0] = char(PGN & 0xFF);
+        payload[1] = char((PGN >> 8) & 0xFF);
+        payload[2] = char((PGN >> 16) & 0xFF);
+        emit sendFrame(m_bus->prepareCANFrame(REQUEST_PGN | address,
+                                              ECU_SOURCE_ADDRESS, payload));
+    }
+    m_pending[k].ids.append(id);
+
+    QTimer::singleShot(timeout, this, [this, id]() { expire(id); });
+    //qDebug() << "Request" << id << "PGN" << PGN << "to" << address;
+    return id;
+}
+
+int j1939Diagnostics::requestPreviousDTCs(int address) {
+    return request(quint8(address), DM2_PGN);
+}
+
+int j1939Diagnostics::clearPreviousDTCs(int address) {
+    return request(quint8(address), DM3_PGN);
+}
+
+int j1939Diagnostics::clearActiveDTCs(int address) {
+    return request(quint8(address), DM11_PGN);
+}
+
+int j1939Diagnostics::pendingRequests() const {
+    int count = 0;
+    for (QHash<quint64, Pending>::const_iterator it = m_pending.constBegin();
+         it != m_pending.constEnd(); ++it)
+        count += it.value().ids.size();
+    return count;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::handleFrame()
+*
+* DESCRIPTION: This function is called for every received frame and takes
+*              the ones that belong to the client: acknowledgements, transport
+*              sessions and responses to outstanding requests.
+*
+* PARAMETERS:  frame- the received frame.
+*
+* Return:      true if the frame was consumed by the client.
+******************************************************************************/
+bool j1939Diagnostics::handleFrame(const QCanBusFrame &frame) {
+    quint32 canId = frame.frameId();
+    quint8 PDUFormat = (canId & PDU_FORMAT_MASK) >> PDU_FORMAT_SHIFT_POSITION;
+    quint8 destination = (canId & PDU_SPECIFIC_MASK) >> PGN_SHIFT_POSITION;
+    quint8 address = (canId & SOURCE_ADRESS_MASK);
+    QByteArray payload = frame.payload();
+
+    if (PDUFormat < PDU2_FORMAT_BOUNDARY &&
+            destination != ECU_SOURCE_ADDRESS && destination != GLOBAL_ADR)
+        return false;
+
+    if (PDUFormat == (ACK_PGN >> PGN_SHIFT_POSITION)) {
+        if (payload.size() < BYTE_DATA_PER_PACKET)
+            return true;
+        quint32 PGN = quint32(quint8(payload.at(5))) |
+                quint32(quint8(payload.at(6))) << 8 |
+                quint32(quint8(payload.at(7))) << 16;
+        acknowledge(address, PGN, payload.at(0) == ACK_CONTROL_ACK);
+        return true;
+    }
+    if (PDUFormat == (TP_CM_PGN >> PGN_SHIFT_POSITION)) {
+        handleConnection(address, destination, payload);
+        return true;
+    }
+    if (PDUFormat == (TP_DT_PGN >> PGN_SHIFT_POSITION)) {
+        handlePacket(address, payload);
+        return true;
+    }
+    if (PDUFormat >= PDU2_FORMAT_BOUNDARY) {
+        quint32 PGN = (canId & PGN_MASK) >> PGN_SHIFT_POSITION;
+        if (m_pending.contains(key(address, PGN))) {
+            complete(address, PGN, payload);
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::handleConnection()
+*
+* DESCRIPTION: This function opens or aborts a transport session carrying the
+*              response of an outstanding request. Sessions for PGNs nobody is
+*              waiting for are ignored.
+*
+* PARAMETERS:  address- the sender address.
+*              destination- the destination of the TP.CM frame.
+*              payload- the TP.CM payload.
+*
+* Return:      None
+******************************************************************************/
+void j1939Diagnostics::handleConnection(quint8 address, quint8 destination,
+                                        const QByteArray &payload) {
+    if (payload.size() < BYTE_DATA_PER_PACKET)
+        return;
+    quint8 control = quint8(payload.at(0));
+    quint32 PGN = quint32(quint8(payload.at(5))) |
+            quint32(quint8(payload.at(6))) << 8 |
+            quint32(quint8(payload.at(7))) << 16;
+
+    if (control == TP_CM_ABORT) {
+        m_sessions.remove(address);
+        return;
+    }
+    bool rts = (control == TP_CM_RTS && destination == ECU_SOURCE_ADDRESS);
+    if (!(rts || control == TP_CM_BAM) ||
+            !m_pending.contains(key(address, PGN)))
+        return;
+
+    Session session;
+    session.PGN = PGN;
+    session.size = quint8(payload.at(1)) | quint8(payload.at(2)) << 8;
+    session.packets = quint8(payload.at(3));
+    session.window = session.packets;
+    if (rts && quint8(payload.at(4)) != 0xFF && quint8(payload.at(4)) != 0)
+        session.window = quint8(payload.at(4));
+    session.rts = rts;
+    session.nextPacket = 1;
+    m_sessions.insert(address, session);
+
+    if (rts)
+        sendClearToSend(address, session);
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::handlePacket()
+*
+* DESCRIPTION: This function appends a TP.DT packet to the open session of the
+*              sender. Once the message is complete it is delivered as the
+*              response of the request.
+*
+* PARAMETERS:  address- the sender address.
+*              payload- the TP.DT payload.
+*
+* Return:      None
+******************************************************************************/
+void j1939Diagnostics::handlePacket(quint8 address, const QByteArray &payload) {
+    if (!m_sessions.contains(address) || payload.isEmpty())
+        return;
+    Session &session = m_sessions[address];
+
+    if (quint8(payload.at(0)) != session.nextPacket) {
+        if (session.rts)
+            sendConnection(address, TP_CM_ABORT, session.PGN,
+                           QByteArray(4, char(0xFF)));
+        m_sessions.remove(address);
+        return;
+    }
+    session.data.append(payload.mid(1, TP_BYTES_PER_PACKET));
+    session.nextPacket++;
+
+    if (session.nextPacket > session.packets) {
+        Session done = m_sessions.take(address);
+        done.data.truncate(done.size);
+        if (done.rts) {
+            QByteArray body(4, char(0xFF));
+            body[0] = char(done.size & 0xFF);
+            body[1] = char(done.size >> 8);
+            body[2] = char(done.packets);
+            sendConnection(address, TP_CM_EOMA, done.PGN, body);
+        }
+        complete(address, done.PGN, done.data);
+    } else if (session.rts && (session.nextPacket - 1) % session.window == 0) {
+        sendClearToSend(address, session);
+    }
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::complete()
+*
+* DESCRIPTION: This function delivers a response to every request waiting for
+*              it and removes them from the outstanding list.
+*
+* PARAMETERS:  address- the device address.
+*              PGN- the PGN of the response.
+*              data- the response data.
+*
+* Return:      None
+******************************************************************************/
+void j1939Diagnostics::complete(quint8 address, quint32 PGN,
+                                const QByteArray &data) {
+    quint64 k = key(address, PGN);
+    if (!m_pending.contains(k))
+        return;
+    Pending pending = m_pending.take(k);
+
+    QVariantList DTCs;
+    if (PGN == DM2_PGN)
+        DTCs = decodeDTCs(data);
+    for (int i = 0; i < pending.ids.size(); i++) {
+        emit responseReceived(pending.ids.at(i), address, int(PGN), data);
+        if (PGN == DM2_PGN)
+            emit previousDTCsReceived(pending.ids.at(i), address, DTCs);
+    }
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::acknowledge()
+*
+* DESCRIPTION: This function handles the acknowledgement of a device. DM3 and
+*              DM11 are answered this way; for any other PGN a NACK means the
+*              device does not support it and is delivered as an empty
+*              response.
+*
+* PARAMETERS:  address- the device address.
+*              PGN- the acknowledged PGN.
+*              acknowledged- false for a NACK.
+*
+* Return:      None
+******************************************************************************/
+void j1939Diagnostics::acknowledge(quint8 address, quint32 PGN,
+                                   bool acknowledged) {
+    if (PGN != DM3_PGN && PGN != DM11_PGN) {
+        if (!acknowledged)
+            complete(address, PGN, QByteArray());
+        return;
+    }
+    quint64 k = key(address, PGN);
+    if (!m_pending.contains(k))
+        return;
+    Pending pending = m_pending.take(k);
+    for (int i = 0; i < pending.ids.size(); i++)
+        emit clearCompleted(pending.ids.at(i), address, acknowledged);
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::expire()
+*
+* DESCRIPTION: This function is executed when the timeout of a request ends.
+*              If the request is still outstanding it is dropped and reported.
+*
+* PARAMETERS:  id- the request id.
+*
+* Return:      None
+******************************************************************************/
+void j1939Diagnostics::expire(int id) {
+    for (QHash<quint64, Pending>::iterator it = m_pending.begin();
+         it != m_pending.end(); ++it) {
+        if (!it.value().ids.removeOne(id))
+            continue;
+        quint8 address = it.value().address;
+        quint32 PGN = it.value().PGN;
+        if (it.value().ids.isEmpty()) {
+            m_pending.erase(it);
+            m_sessions.remove(address);
+        }
+        emit requestTimedOut(id, address, int(PGN));
+        return;
+    }
+}
+
+void j1939Diagnostics::sendClearToSend(quint8 address, const Session &session) {
+    int remaining = session.packets - session.nextPacket + 1;
+    QByteArray body(4, char(0xFF));
+    body[0] = char(qMin(remaining, session.window));
+    body[1] = char(session.nextPacket);
+    sendConnection(address, TP_CM_CTS, session.PGN, body);
+}
+
+void j1939Diagnostics::sendConnection(quint8 address, quint8 control,
+                                      quint32 PGN, const QByteArray &body) {
+    QByteArray payload(BYTE_DATA_PER_PACKET, char(0xFF));
+    payload[0] = char(control);
+    for (int i = 0; i < 4 && i < body.size(); i++)
+        payload[i + 1] = body.at(i);
+    payload[5] = char(PGN & 0xFF);
+    payload[6] = char((PGN >> 8) & 0xFF);
+    payload[7] = char((PGN >> 16) & 0xFF);
+    emit sendFrame(m_bus->prepareCANFrame(TP_CM_PGN | address,
+                                          ECU_SOURCE_ADDRESS, payload));
+}
+
+quint64 j1939Diagnostics::key(quint8 address, quint32 PGN) {
+    return quint64(address) << 32 | PGN;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Diagnostics::decodeDTCs()
+*
+* DESCRIPTION: This function splits a DM1/DM2 message in its DTCs. Every DTC is
+*              returned as a map with its SPN, FMI and occurrence count so it
+*              can be shown from qml. The all-zero "no faults" DTC is skipped.
+*
+* PARAMETERS:  data- the DM message, lamp status bytes included.
+*
+* Return:      The list of DTCs.
+******************************************************************************/
+QVariantList j1939Diagnostics::decodeDTCs(const QByteArray &data) {
+    QVariantList DTCs;
+    for (int pos = DTC_POS; pos + DTC_LENGTH <= data.size(); pos += DTC_LENGTH) {
+        quint8 b0 = quint8(data.at(pos));
+        quint8 b1 = quint8(data.at(pos + 1));
+        quint8 b2 = quint8(data.at(pos + 2));
+        quint8 b3 = quint8(data.at(pos + 3));
+        if (b0 == EMPTY_PAYLOAD && b1 == EMPTY_PAYLOAD && b2 == EMPTY_PAYLOAD)
+            continue;
+
+        QVariantMap DTC;
+        DTC["spn"] = quint32(b0) | quint32(b1) << MSB_SHIFT_POSITION |
+                quint32((b2 & SPN_MSB_MASK) >> SPN_MSB_SHIFT_POSITION) << 16;
+        DTC["fmi"] = b2 & FMI_MASK;
+        DTC["oc"] = b3 & OC_MASK;
+        DTCs.append(DTC);
+    }
+    return DTCs;
+}
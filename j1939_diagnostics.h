@@ -0,0 +1,95 @@
+#ifndef J1939_DIAGNOSTICS_H
+#define J1939_DIAGNOSTICS_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QCanBusFrame>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QVariantList>
+#include "j1939_config.h"
+
+class j1939;
+
+/******************************************************************************
+ *
+ * Class: j1939Diagnostics
+ *
+ * This class is an asynchronous diagnostic client for the devices on the bus.
+ * It requests previously active DTCs (DM2) and clears DTCs (DM3 previously
+ * active, DM11 active). Every call returns at once with a request id, and the
+ * result is delivered later through a signal carrying that id.
+ *
+ * Requests to different devices, or for different PGNs on the same device,
+ * are all outstanding at the same time. A request for a PGN that is already
+ * waiting on that device joins it, and every id gets the same answer. Each
+ * request expires after its timeout if no response arrives. Requests are
+ * sent to one device only, a request to GLOBAL_ADR is refused with id -1.
+ *
+ * Responses longer than 8 bytes are reassembled from TP.BAM or TP.RTS/CTS
+ * sessions.
+ *
+******************************************************************************/
+
+class j1939Diagnostics : public QObject {
+    Q_OBJECT
+public:
+    explicit j1939Diagnostics(j1939 *bus, QObject *parent = nullptr);
+
+    int request(quint8 address, quint32 PGN,
+                int timeout = DIAG_RESPONSE_TIMEOUT_MS);
+    bool handleFrame(const QCanBusFrame &frame);
+
+    Q_INVOKABLE int requestPreviousDTCs(int address);
+    Q_INVOKABLE int clearPreviousDTCs(int address);
+    Q_INVOKABLE int clearActiveDTCs(int address);
+    Q_INVOKABLE int pendingRequests() const;
+
+signals:
+    void sendFrame(const QCanBusFrame &frame);
+    void responseReceived(int id, int address, int PGN, QByteArray data);
+    void previousDTCsReceived(int id, int address, QVariantList DTCs);
+    void clearCompleted(int id, int address, bool acknowledged);
+    void requestTimedOut(int id, int address, int PGN);
+
+private:
+    struct Pending {
+        quint8 address;
+        quint32 PGN;
+        QList<int> ids;
+    };
+
+    struct Session {
+        quint32 PGN;
+        int size;
+        int packets;
+        int window;
+        bool rts;
+        quint8 nextPacket;
+        QByteArray data;
+    };
+
+    static quint64 key(quint8 address, quint32 PGN);
+    static QVariantList decodeDTCs(const QByteArray &data);
+
+    void expire(int id);
+    void complete(quint8 address, quint32 PGN, const QByteArray &data);
+    void acknowledge(quint8 address, quint32 PGN, bool acknowledged);
+    void handleConnection(quint8 address, quint8 destination,
+                          const QByteArray &payload);
+    void handlePacket(quint8 address, const QByteArray &payload);
+    void sendClearToSend(quint8 address, const Session &session);
+    void sendConnection(quint8 address, quint8 control, quint32 PGN,
+                        const QByteArray &body);
+
+    j1939 *m_bus;
+    int m_nextId = 1;
+
+    // outstanding requests indexed by key(address, PGN)
+    QHash<quint64, Pending> m_pending;
+    // open transport sessions indexed by the sender address
+    QHash<quint8, Session> m_sessions;
+};
+
+#endif // J1939_DIAGNOSTICS_H
@@ -0,0 +1,309 @@
+#include "j1939_link.h"
+#include <QDebug>
+#include <QThread>
+#include <cerrno>
+#include <cstring>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/can/netlink.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+QElapsedTimer j1939Link::s_startup;
+
+namespace {
+
+const int NETLINK_BUFFER_SIZE = 4096;
+
+struct LinkRequest {
+    nlmsghdr header;
+    ifinfomsg info;
+    char attributes[NETLINK_BUFFER_SIZE];
+};
+
+rtattr *addAttribute(nlmsghdr *header, unsigned short type,
+                     const void *data, unsigned short length) {
+    rtattr *attribute = reinterpret_cast<rtattr *>(
+                reinterpret_cast<char *>(header) +
+                NLMSG_ALIGN(header->nlmsg_len));
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(length);
+    if (length)
+        memcpy(RTA_DATA(attribute), data, length);
+    header->nlmsg_len = NLMSG_ALIGN(header->nlmsg_len) +
+            RTA_ALIGN(attribute->rta_len);
+    return attribute;
+}
+
+void endNested(nlmsghdr *header, rtattr *nested) {
+    nested->rta_len = static_cast<unsigned short>(
+                reinterpret_cast<char *>(header) + header->nlmsg_len -
+                reinterpret_cast<char *>(nested));
+}
+
+void parseAttributes(rtattr *table[], int max, rtattr *attribute, int length) {
+    memset(table, 0, sizeof(rtattr *) * (max + 1));
+    for (; RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length)) {
+        if (attribute->rta_type <= max)
+            table[attribute->rta_type] = attribute;
+    }
+}
+
+}
+
+/******************************************************************************
+* FUNCTION: j1939Link()
+*
+* DESCRIPTION: This is the constructor of the class.
+*
+* PARAMETERS:  name- the CAN interface name.
+*              bitrate- the bitrate the interface must run at.
+*
+* Return:      None
+******************************************************************************/
+j1939Link::j1939Link(const QString &name, quint32 bitrate, QObject *parent)
+    : QObject(parent), m_name(name), m_bitrate(bitrate) {
+}
+
+/******************************************************************************
+* FUNCTION: j1939Link::markPhase()
+*
+* DESCRIPTION: This function logs the time elapsed since the first call, which
+*              is done at the start of main().
+*
+* PARAMETERS:  phase- name of the startup phase reached.
+*
+* Return:      None
+******************************************************************************/
+void j1939Link::markPhase(const char *phase) {
+    if (!s_startup.isValid())
+        s_startup.start();
+    qDebug() << "Startup:" << phase << s_startup.nsecsElapsed() / 1000000.0
+             << "ms";
+}
+
+/******************************************************************************
+* FUNCTION: j1939Link::bringUp()
+*
+* DESCRIPTION: This function checks the interface and brings it up at the
+*              configured bitrate and with loopback off if needed, a bus-off
+*              controller is restarted. It emits linkUp() when the interface is up and its
+*              controller is not bus-off or stopped, otherwise linkFailed().
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939Link::bringUp() {
+    QString error;
+    LinkInfo info;
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        emit linkFailed(QStringLiteral("netlink socket: ") + strerror(errno));
+        return;
+    }
+
+    bool ok = query(fd, info, error);
+    if (ok && info.isCan && (info.bitrate != m_bitrate || info.loopback)) {
+        // the bitrate and mode can only be changed with the interface down
+        ok = (!info.up || setLink(fd, info, false, false, error)) &&
+                setLink(fd, info, true, true, error);
+    } else if (ok && !info.up) {
+        ok = setLink(fd, info, true, false, error);
+    } else if (ok && info.isCan && (info.state == CAN_STATE_BUS_OFF ||
+                                    info.state == CAN_STATE_STOPPED)) {
+        // setting the interface down and up restarts the controller
+        ok = setLink(fd, info, false, false, error) &&
+                setLink(fd, info, true, false, error);
+    }
+
+    for (int i = 0; ok && i < LINK_UP_RETRIES; i++) {
+        ok = query(fd, info, error);
+        if (ok && info.up)
+            break;
+        QThread::msleep(LINK_UP_RETRY_MS);
+    }
+    close(fd);
+
+    if (ok && !info.up) {
+        ok = false;
+        error = m_name + " did not come up";
+    }
+    if (ok && info.isCan && (info.state == CAN_STATE_BUS_OFF ||
+                             info.state == CAN_STATE_STOPPED)) {
+        ok = false;
+        error = m_name + " controller is bus-off or stopped";
+    }
+
+    if (!ok) {
+        qDebug() << "Link error:" << error;
+        emit linkFailed(error);
+        return;
+    }
+    markPhase("link up");
+    emit linkUp(m_name);
+}
+
+/******************************************************************************
+* FUNCTION: j1939Link::query()
+*
+* DESCRIPTION: This function reads the flags, kind, bitrate, control mode and
+*              controller state of the interface with RTM_GETLINK.
+*
+* PARAMETERS:  fd- netlink socket.
+*              info- filled with the interface information.
+*              error- set when the function fails.
+*
+* Return:      true on success.
+******************************************************************************/
+bool j1939Link::query(int fd, LinkInfo &info, QString &error) {
+    info = LinkInfo();
+    info.index = int(if_nametoindex(m_name.toLocal8Bit().constData()));
+    if (info.index == 0) {
+        error = m_name + " not found";
+        return false;
+    }
+
+    LinkRequest request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+    request.header.nlmsg_type = RTM_GETLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = ++m_sequence;
+    request.info.ifi_family = AF_UNSPEC;
+    request.info.ifi_index = info.index;
+
+    if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+        error = QStringLiteral("netlink send: ") + strerror(errno);
+        return false;
+    }
+
+    char buffer[NETLINK_BUFFER_SIZE * 2];
+    ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+        error = QStringLiteral("netlink recv: ") + strerror(errno);
+        return false;
+    }
+
+    nlmsghdr *header = reinterpret_cast<nlmsghdr *>(buffer);
+    for (; NLMSG_OK(header, quint32(length));
+         header = NLMSG_NEXT(header, length)) {
+        if (header->nlmsg_type == NLMSG_ERROR) {
+            nlmsgerr *nlError = static_cast<nlmsgerr *>(NLMSG_DATA(header));
+            error = QStringLiteral("RTM_GETLINK: ") + strerror(-nlError->error);
+            return false;
+        }
+        if (header->nlmsg_type != RTM_NEWLINK)
+            continue;
+
+        ifinfomsg *ifi = static_cast<ifinfomsg *>(NLMSG_DATA(header));
+        info.up = ifi->ifi_flags & IFF_UP;
+
+        rtattr *table[IFLA_MAX + 1];
+        parseAttributes(table, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(header));
+        if (!table[IFLA_LINKINFO])
+            return true;
+
+        rtattr *linkInfo[IFLA_INFO_MAX + 1];
+        parseAttributes(linkInfo, IFLA_INFO_MAX,
+                        static_cast<rtattr *>(RTA_DATA(table[IFLA_LINKINFO])),
+                        RTA_PAYLOAD(table[IFLA_LINKINFO]));
+        if (!linkInfo[IFLA_INFO_KIND])
+            return true;
+        info.isCan = strcmp(static_cast<char *>(
+                                RTA_DATA(linkInfo[IFLA_INFO_KIND])), "can") == 0;
+        if (!info.isCan || !linkInfo[IFLA_INFO_DATA])
+            return true;
+
+        rtattr *canInfo[IFLA_CAN_MAX + 1];
+        parseAttributes(canInfo, IFLA_CAN_MAX,
+                        static_cast<rtattr *>(RTA_DATA(linkInfo[IFLA_INFO_DATA])),
+                        RTA_PAYLOAD(linkInfo[IFLA_INFO_DATA]));
+        if (canInfo[IFLA_CAN_BITTIMING])
+            info.bitrate = static_cast<can_bittiming *>(
+                        RTA_DATA(canInfo[IFLA_CAN_BITTIMING]))->bitrate;
+        if (canInfo[IFLA_CAN_STATE])
+            info.state = *static_cast<quint32 *>(
+                        RTA_DATA(canInfo[IFLA_CAN_STATE]));
+        if (canInfo[IFLA_CAN_CTRLMODE])
+            info.loopback = static_cast<can_ctrlmode *>(
+                        RTA_DATA(canInfo[IFLA_CAN_CTRLMODE]))->flags &
+                    CAN_CTRLMODE_LOOPBACK;
+        return true;
+    }
+    error = m_name + " no link information";
+    return false;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Link::setLink()
+*
+* DESCRIPTION: This function sets the interface up or down with RTM_NEWLINK.
+*              When configure is set, the bitrate is written and loopback is
+*              turned off in the same message.
+*
+* PARAMETERS:  fd- netlink socket.
+*              info- the interface information from query().
+*              up- the wanted interface state.
+*              configure- also write the bitrate and control mode.
+*              error- set when the function fails.
+*
+* Return:      true on success.
+******************************************************************************/
+bool j1939Link::setLink(int fd, const LinkInfo &info, bool up, bool configure,
+                        QString &error) {
+    LinkRequest request;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+    request.header.nlmsg_type = RTM_NEWLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    request.header.nlmsg_seq = ++m_sequence;
+    request.info.ifi_family = AF_UNSPEC;
+    request.info.ifi_index = info.index;
+    request.info.ifi_change = IFF_UP;
+    request.info.ifi_flags = up ? IFF_UP : 0;
+
+    if (configure) {
+        can_bittiming timing;
+        memset(&timing, 0, sizeof(timing));
+        timing.bitrate = m_bitrate;
+        can_ctrlmode mode;
+        mode.mask = CAN_CTRLMODE_LOOPBACK;
+        mode.flags = 0;
+
+        rtattr *linkInfo = addAttribute(&request.header, IFLA_LINKINFO,
+                                        nullptr, 0);
+        addAttribute(&request.header, IFLA_INFO_KIND, "can", 3);
+        rtattr *data = addAttribute(&request.header, IFLA_INFO_DATA,
+                                    nullptr, 0);
+        addAttribute(&request.header, IFLA_CAN_BITTIMING,
+                     &timing, sizeof(timing));
+        addAttribute(&request.header, IFLA_CAN_CTRLMODE, &mode, sizeof(mode));
+        endNested(&request.header, data);
+        endNested(&request.header, linkInfo);
+    }
+
+    if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+        error = QStringLiteral("netlink send: ") + strerror(errno);
+        return false;
+    }
+
+    char buffer[NETLINK_BUFFER_SIZE];
+    ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+        error = QStringLiteral("netlink recv: ") + strerror(errno);
+        return false;
+    }
+    nlmsghdr *header = reinterpret_cast<nlmsghdr *>(buffer);
+    if (NLMSG_OK(header, quint32(length)) &&
+            header->nlmsg_type == NLMSG_ERROR) {
+        nlmsgerr *nlError = static_cast<nlmsgerr *>(NLMSG_DATA(header));
+        if (nlError->error != 0) {
+            error = QStringLiteral("RTM_NEWLINK: ") + strerror(-nlError->error);
+            return false;
+        }
+    }
+    return true;
+}
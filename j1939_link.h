@@ -0,0 +1,66 @@
+#ifndef J1939_LINK_H
+#define J1939_LINK_H
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include "j1939_config.h"
+
+/******************************************************************************
+ *
+ * Class: j1939Link
+ *
+ * This class brings the CAN interface up through rtnetlink, replacing the
+ * "ip link" calls of the old startup script. The interface is only
+ * reconfigured when its bitrate is wrong or loopback is on, set up when it
+ * is down, and restarted when its controller is bus-off. Its state is
+ * checked afterwards. Virtual interfaces (vcan) only need to be set up.
+ *
+ * bringUp() blocks on the netlink socket, so it is meant to run on a worker
+ * thread while the QML is loading. The process needs CAP_NET_ADMIN to change
+ * the interface, e.g. "sudo setcap cap_net_admin+ep JDInterfaz".
+ *
+ * markPhase() logs the time since the start of the process for each startup
+ * phase, to measure the time to the first gauge value.
+ *
+******************************************************************************/
+
+class j1939Link : public QObject {
+    Q_OBJECT
+public:
+    explicit j1939Link(const QString &name = QStringLiteral(CAN_INTERFACE),
+                       quint32 bitrate = CAN_BITRATE,
+                       QObject *parent = nullptr);
+
+    static void markPhase(const char *phase);
+
+public slots:
+    void bringUp();
+
+signals:
+    void linkUp(const QString &name);
+    void linkFailed(const QString &error);
+
+private:
+    struct LinkInfo {
+        int index = 0;
+        bool up = false;
+        bool isCan = false;
+        quint32 bitrate = 0;
+        quint32 state = 0;
+        bool loopback = false;
+    };
+
+    bool query(int fd, LinkInfo &info, QString &error);
+    bool setLink(int fd, const LinkInfo &info, bool up, bool configure,
+                 QString &error);
+
+    QString m_name;
+    quint32 m_bitrate;
+    quint32 m_sequence = 0;
+
+    static QElapsedTimer s_startup;
+};
+
+#endif // J1939_LINK_H
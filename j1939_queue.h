@@ -0,0 +1,108 @@
+#ifndef J1939_QUEUE_H
+#define J1939_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/******************************************************************************
+ *
+ * Class: j1939Queue
+ *
+ * Bounded lock-free queue with any number of producers and consumers. Every
+ * slot carries a sequence number that tells whether it is free for the
+ * producer of a given position or holds data for the consumer of that
+ * position, so push() and pop() only race on one atomic index each.
+ *
+ * The capacity is rounded up to a power of two. push() fails when the queue
+ * is full instead of blocking.
+ *
+******************************************************************************/
+
+template <typename T>
+class j1939Queue {
+public:
+    explicit j1939Queue(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_slots = std::vector<Slot>(size);
+        for (std::size_t i = 0; i < size; i++)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    bool push(const T &value) {
+        std::size_t pos = m_tail.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &m_slots[pos & m_mask];
+            std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos);
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                                 std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = value;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) {
+        std::size_t pos = m_head.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &m_slots[pos & m_mask];
+            std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = std::ptrdiff_t(sequence) -
+                    std::ptrdiff_t(pos + 1);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1,
+                                                 std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        value = slot->value;
+        slot->value = T();
+        slot->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // approximate while producers or consumers are running
+    std::size_t size() const {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        return tail - head;
+    }
+
+private:
+    struct Slot {
+        Slot() : sequence(0) {}
+        Slot(const Slot &other) : sequence(other.sequence.load()),
+            value(other.value) {}
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::vector<Slot> m_slots;
+    std::size_t m_mask;
+    // head and tail a cache line apart, padded rather than alignas(64),
+    // which operator new does not honour before C++17
+    std::atomic<std::size_t> m_head;
+    char m_padding[64];
+    std::atomic<std::size_t> m_tail;
+};
+
+#endif // J1939_QUEUE_H
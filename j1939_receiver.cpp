@@ -0,0 +1,277 @@
+#include "j1939_receiver.h"
+#include "j1939_link.h"
+#include <QByteArray>
+#include <QDebug>
+#include <cerrno>
+#include <cstring>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+/******************************************************************************
+* FUNCTION: j1939Receiver()
+*
+* DESCRIPTION: This is the constructor of the class. The thread is started by
+*              the owner.
+*
+* PARAMETERS:  interface- the CAN interface, e.g. can0.
+*              profile- the real-time profile applied by the thread.
+*              bus- where the decoded samples are published.
+*              stats- where the receive-to-decode latencies are recorded.
+*              parent- the QObject parent.
+*
+* Return:      None
+******************************************************************************/
+j1939Receiver::j1939Receiver(const QString &interface,
+                             const j1939RtProfile &profile,
+                             j1939SignalBus *bus, j1939LatencyStats *stats,
+                             QObject *parent)
+    : QThread(parent), m_interface(interface), m_profile(profile),
+      m_bus(bus), m_stats(stats), m_sent(RT_SENT_FRAMES) {
+    qRegisterMetaType<QCanBusFrame>();
+    memset(m_recent, 0, sizeof(m_recent));
+}
+
+j1939Receiver::~j1939Receiver() {
+    requestInterruption();
+    wait();
+}
+
+/******************************************************************************
+* FUNCTION: j1939Receiver::frameSent()
+*
+* DESCRIPTION: This function records a frame about to be written to the CAN
+*              device, so its loop back is not received. It is called before
+*              the write, the loop back may arrive before the write returns.
+*              It may be called from any thread.
+*
+* PARAMETERS:  frame- the frame sent.
+*
+* Return:      None
+******************************************************************************/
+void j1939Receiver::frameSent(const QCanBusFrame &frame) {
+    m_sent.push(sentFrame(frame, true));
+}
+
+// retracts a frame reported by frameSent() that the device did not write
+void j1939Receiver::frameNotSent(const QCanBusFrame &frame) {
+    m_sent.push(sentFrame(frame, false));
+}
+
+j1939Receiver::SentFrame j1939Receiver::sentFrame(const QCanBusFrame &frame,
+                                                  bool pending) {
+    SentFrame sent;
+    memset(&sent, 0, sizeof(sent));
+    QByteArray payload = frame.payload();
+    sent.id = frame.frameId() & CAN_EFF_MASK;
+    sent.length = quint8(qMin(payload.size(), int(BYTE_DATA_PER_PACKET)));
+    memcpy(sent.data, payload.constData(), sent.length);
+    sent.pending = pending;
+    return sent;
+}
+
+// moves the frames reported by frameSent() to m_recent, so m_sent never fills,
+// a retraction forgets the newest matching frame
+void j1939Receiver::drainSent() {
+    SentFrame sent;
+    while (m_sent.pop(sent)) {
+        if (sent.pending) {
+            m_recent[m_recentNext] = sent;
+            m_recentNext = (m_recentNext + 1) % RT_SENT_FRAMES;
+            continue;
+        }
+        for (int i = 1; i <= RT_SENT_FRAMES; i++) {
+            SentFrame &recent = m_recent[(m_recentNext + RT_SENT_FRAMES - i) %
+                                         RT_SENT_FRAMES];
+            if (recent.pending && recent.id == sent.id &&
+                    recent.length == sent.length &&
+                    memcmp(recent.data, sent.data, sent.length) == 0) {
+                recent.pending = false;
+                break;
+            }
+        }
+    }
+}
+
+/******************************************************************************
+* FUNCTION: j1939Receiver::ownFrame()
+*
+* DESCRIPTION: This function tells if a frame looped back by the kernel is
+*              one of the frames sent by the dashboard, and forgets it. The
+*              last RT_SENT_FRAMES sent frames are kept.
+*
+* PARAMETERS:  id- the CAN id, without flags.
+*              data- the payload.
+*              length- the payload length.
+*
+* Return:      true if the frame was sent by the dashboard.
+******************************************************************************/
+bool j1939Receiver::ownFrame(quint32 id, const quint8 *data, int length) {
+    drainSent();
+    for (int i = 0; i < RT_SENT_FRAMES; i++) {
+        SentFrame &recent = m_recent[i];
+        if (recent.pending && recent.id == id && recent.length == length &&
+                memcmp(recent.data, data, size_t(length)) == 0) {
+            recent.pending = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Receiver::openSocket()
+*
+* DESCRIPTION: This function opens a raw CAN socket bound to the interface,
+*              with kernel reception timestamps. Error frames are not
+*              requested.
+*
+* PARAMETERS:  None
+*
+* Return:      The socket, -1 if the interface is not available.
+******************************************************************************/
+int j1939Receiver::openSocket() {
+    int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+    if (fd < 0)
+        return -1;
+
+    ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    QByteArray name = m_interface.toLocal8Bit();
+    strncpy(ifr.ifr_name, name.constData(), IFNAMSIZ - 1);
+    int on = 1;
+    sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0) {
+        close(fd);
+        return -1;
+    }
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Receiver::run()
+*
+* DESCRIPTION: This is the receive loop. The profile is applied first, then
+*              every extended data frame is timestamped by the kernel, decoded
+*              and handed over. Frames sent by the dashboard are skipped, the
+*              first other frame is marked as a startup phase. Nothing is
+*              allocated nor locked for the measurement PGNs. The loop polls
+*              with a RT_POLL_MS timeout to notice the interruption request.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939Receiver::run() {
+    if (m_profile.enabled) {
+        QString error;
+        if (!applyRtProfile(m_profile, &error))
+            qDebug() << "Real-time profile not fully applied:" << error;
+    }
+
+    can_frame frame;
+    char control[CMSG_SPACE(sizeof(timeval))];
+    iovec iov;
+    iov.iov_base = &frame;
+    iov.iov_len = sizeof(frame);
+    msghdr message;
+    j1939Sample samples[DECODE_MAX_SAMPLES];
+    int fd = -1;
+    bool reported = false;
+    bool firstFrame = false;
+
+    while (!isInterruptionRequested()) {
+        if (fd < 0) {
+            fd = openSocket();
+            if (fd < 0) {
+                if (!reported)
+                    qDebug() << "Receiver waiting for" << m_interface;
+                reported = true;
+                msleep(RT_REOPEN_MS);
+                continue;
+            }
+            reported = false;
+        }
+
+        pollfd descriptor = {fd, POLLIN, 0};
+        if (poll(&descriptor, 1, RT_POLL_MS) <= 0) {
+            drainSent();
+            continue;
+        }
+
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t received = recvmsg(fd, &message, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            // the interface went down, reopen once it is back
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if (received < ssize_t(sizeof(frame)) ||
+                !(frame.can_id & CAN_EFF_FLAG) ||
+                (frame.can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)))
+            continue;
+        // every frame sent on this host comes back with MSG_DONTROUTE, the
+        // ones of the dashboard are never seen by the QCanBusDevice
+        quint32 canId = frame.can_id & CAN_EFF_MASK;
+        if ((message.msg_flags & MSG_DONTROUTE) &&
+                ownFrame(canId, frame.data, frame.can_dlc))
+            continue;
+        if (!firstFrame) {
+            firstFrame = true;
+            j1939Link::markPhase("first frame");
+        }
+
+        qint64 time = 0;
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header;
+             header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET &&
+                    header->cmsg_type == SCM_TIMESTAMP) {
+                timeval stamp;
+                memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+                time = qint64(stamp.tv_sec) * 1000000 + stamp.tv_usec;
+            }
+        }
+        if (!time)
+            time = realtimeMicros();
+
+        int count = j1939Decode(canId, frame.data, frame.can_dlc, time,
+                                samples);
+        if (count) {
+            for (int i = 0; i < count; i++)
+                m_bus->publish(samples[i]);
+            m_stats->record(realtimeMicros() - time);
+            continue;
+        }
+
+        QCanBusFrame busFrame(canId, QByteArray(
+                                  reinterpret_cast<const char *>(frame.data),
+                                  frame.can_dlc));
+        busFrame.setExtendedFrameFormat(true);
+        busFrame.setTimeStamp(QCanBusFrame::TimeStamp(time / 1000000,
+                                                      time % 1000000));
+        emit frameReceived(busFrame);
+    }
+    if (fd >= 0)
+        close(fd);
+}
@@ -0,0 +1,85 @@
+#ifndef J1939_RECEIVER_H
+#define J1939_RECEIVER_H
+
+#include <QtGlobal>
+#include <QCanBusFrame>
+#include <QMetaType>
+#include <QString>
+#include <QThread>
+#include "j1939_bus.h"
+#include "j1939_config.h"
+#include "j1939_decoder.h"
+#include "j1939_queue.h"
+#include "j1939_rt.h"
+
+/******************************************************************************
+ *
+ * Class: j1939Receiver
+ *
+ * This class is the receive path of the real-time profile. It reads the
+ * interface through its own raw CAN socket on a thread with the profile
+ * applied, and decodes the measurement PGNs right there with j1939Decode().
+ * The receive-to-decode latency of those frames is recorded in the given
+ * j1939LatencyStats.
+ *
+ * Samples are published on the j1939SignalBus, this thread is the producer
+ * of the measurement signals. Every other data frame (DM1, requests,
+ * transport, ...) is queued to the thread of the j1939 object with
+ * frameReceived(). Error frames are left to the QCanBusDevice, which keeps
+ * handling the bus-off recovery.
+ *
+ * The frames this dashboard sends are looped back to the socket by the
+ * kernel. The TX scheduler reports them with frameSent() right before the
+ * write, and frameNotSent() if the device refused it, and their loop backs
+ * are skipped, so this path sees the same frames as the QCanBusDevice.
+ * Frames of other programs on the host, like jdsim on vcan0, are still
+ * received.
+ *
+ * The socket is reopened every RT_REOPEN_MS while the interface is down.
+ *
+******************************************************************************/
+
+class j1939Receiver : public QThread {
+    Q_OBJECT
+public:
+    j1939Receiver(const QString &interface, const j1939RtProfile &profile,
+                  j1939SignalBus *bus, j1939LatencyStats *stats,
+                  QObject *parent = nullptr);
+    ~j1939Receiver();
+
+    void frameSent(const QCanBusFrame &frame);
+    void frameNotSent(const QCanBusFrame &frame);
+
+signals:
+    void frameReceived(const QCanBusFrame &frame);
+
+protected:
+    void run() override;
+
+private:
+    struct SentFrame {
+        quint32 id;
+        quint8 length;
+        quint8 data[BYTE_DATA_PER_PACKET];
+        // waiting for its loop back, in m_sent false retracts the frame
+        bool pending;
+    };
+
+    static SentFrame sentFrame(const QCanBusFrame &frame, bool pending);
+
+    int openSocket();
+    void drainSent();
+    bool ownFrame(quint32 id, const quint8 *data, int length);
+
+    QString m_interface;
+    j1939RtProfile m_profile;
+    j1939SignalBus *m_bus;
+    j1939LatencyStats *m_stats;
+    // frames sent, handed over by frameSent(), and the ones not looped back
+    // yet, only used by the thread
+    j1939Queue<SentFrame> m_sent;
+    SentFrame m_recent[RT_SENT_FRAMES];
+    int m_recentNext = 0;
+};
+
+#endif // J1939_RECEIVER_H
@@ -0,0 +1,158 @@
+#include "j1939_recovery.h"
+#include <QDebug>
+
+/******************************************************************************
+* FUNCTION: j1939Recovery()
+*
+* DESCRIPTION: This is the constructor of the class, it sets up the backoff
+*              timer that emits reconnect().
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+j1939Recovery::j1939Recovery(QObject *parent) : QObject(parent) {
+    m_backoffTimer.setSingleShot(true);
+    connect(&m_backoffTimer, &QTimer::timeout, this, [this]() {
+        m_reconnects++;
+        emit countersChanged();
+        emit reconnect();
+    });
+}
+
+/******************************************************************************
+* FUNCTION: j1939Recovery::errorFrame()
+*
+* DESCRIPTION: This function counts a received error frame and the controller
+*              overflows it reports.
+*
+* PARAMETERS:  frame- the error frame.
+*
+* Return:      true if the controller went bus-off.
+******************************************************************************/
+bool j1939Recovery::errorFrame(const QCanBusFrame &frame) {
+    QCanBusFrame::FrameErrors errors = frame.error();
+    m_errorFrames++;
+
+    if (errors & QCanBusFrame::ControllerError) {
+        QByteArray payload = frame.payload();
+        if (payload.size() > ERROR_CONTROLLER_BYTE &&
+                (payload.at(ERROR_CONTROLLER_BYTE) & ERROR_OVERFLOW_MASK))
+            m_overflows++;
+    }
+    emit countersChanged();
+
+    if (errors & QCanBusFrame::BusOffError) {
+        m_busOffs++;
+        return true;
+    }
+    return false;
+}
+
+void j1939Recovery::deviceError(QCanBusDevice::CanBusError error) {
+    Q_UNUSED(error)
+    m_deviceErrors++;
+    emit countersChanged();
+}
+
+/******************************************************************************
+* FUNCTION: j1939Recovery::fault()
+*
+* DESCRIPTION: This function starts a recovery. The first reconnect is tried
+*              after RECONNECT_BACKOFF_MIN_MS. A fault during a recovery is
+*              ignored, the running backoff continues.
+*
+* PARAMETERS:  reason- description for the log.
+*
+* Return:      None
+******************************************************************************/
+void j1939Recovery::fault(const QString &reason) {
+    qDebug() << "CAN fault:" << reason;
+    if (m_recovering)
+        return;
+    m_recovering = true;
+    m_recoveryTimer.start();
+    m_backoff = RECONNECT_BACKOFF_MIN_MS;
+    m_backoffTimer.start(m_backoff);
+    emit countersChanged();
+}
+
+/******************************************************************************
+* FUNCTION: j1939Recovery::attemptFailed()
+*
+* DESCRIPTION: This function schedules the next reconnect, doubling the wait
+*              up to RECONNECT_BACKOFF_MAX_MS. A failure outside a recovery is
+*              the first connection at startup: it is retried after
+*              RECONNECT_BACKOFF_MIN_MS and the retries are not timed.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939Recovery::attemptFailed() {
+    if (!m_recovering) {
+        m_recovering = true;
+        m_backoff = RECONNECT_BACKOFF_MIN_MS;
+    } else {
+        m_backoff = qMin(m_backoff * 2, RECONNECT_BACKOFF_MAX_MS);
+    }
+    m_backoffTimer.start(m_backoff);
+    emit countersChanged();
+}
+
+/******************************************************************************
+* FUNCTION: j1939Recovery::recovered()
+*
+* DESCRIPTION: This function ends the recovery and keeps the time it took.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939Recovery::recovered() {
+    m_backoffTimer.stop();
+    if (!m_recovering)
+        return;
+    m_recovering = false;
+    if (!m_recoveryTimer.isValid()) {
+        emit countersChanged();
+        return;
+    }
+    m_lastRecoveryTime = m_recoveryTimer.elapsed();
+    m_maxRecoveryTime = qMax(m_maxRecoveryTime, m_lastRecoveryTime);
+    m_recoveryTimer.invalidate();
+    qDebug() << "CAN recovered in" << m_lastRecoveryTime << "ms";
+    emit countersChanged();
+}
+
+bool j1939Recovery::recovering() const {
+    return m_recovering;
+}
+
+quint64 j1939Recovery::errorFrames() const {
+    return m_errorFrames;
+}
+
+quint64 j1939Recovery::deviceErrors() const {
+    return m_deviceErrors;
+}
+
+quint64 j1939Recovery::busOffs() const {
+    return m_busOffs;
+}
+
+quint64 j1939Recovery::overflows() const {
+    return m_overflows;
+}
+
+quint64 j1939Recovery::reconnects() const {
+    return m_reconnects;
+}
+
+qint64 j1939Recovery::lastRecoveryTime() const {
+    return m_lastRecoveryTime;
+}
+
+qint64 j1939Recovery::maxRecoveryTime() const {
+    return m_maxRecoveryTime;
+}
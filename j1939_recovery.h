@@ -0,0 +1,78 @@
+#ifndef J1939_RECOVERY_H
+#define J1939_RECOVERY_H
+
+#include <QtGlobal>
+#include <QCanBusDevice>
+#include <QCanBusFrame>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include "j1939_config.h"
+
+/******************************************************************************
+ *
+ * Class: j1939Recovery
+ *
+ * This class keeps the error counters of the CAN device and decides when to
+ * reconnect it. A fault (bus-off, a device error, or the interface going
+ * away) starts a recovery. The reconnect() signal is then emitted with an
+ * exponential backoff from RECONNECT_BACKOFF_MIN_MS up to
+ * RECONNECT_BACKOFF_MAX_MS, until recovered() is called. The time from the
+ * fault to the recovery is kept as a metric. Retries of a device that was
+ * never connected use the same backoff, but are not timed.
+ *
+ * Overflows are the error frames with a controller overflow flag, each one
+ * means one or more frames were lost.
+ *
+******************************************************************************/
+
+class j1939Recovery : public QObject {
+    Q_OBJECT
+    Q_PROPERTY(bool recovering READ recovering NOTIFY countersChanged)
+    Q_PROPERTY(quint64 errorFrames READ errorFrames NOTIFY countersChanged)
+    Q_PROPERTY(quint64 deviceErrors READ deviceErrors NOTIFY countersChanged)
+    Q_PROPERTY(quint64 busOffs READ busOffs NOTIFY countersChanged)
+    Q_PROPERTY(quint64 overflows READ overflows NOTIFY countersChanged)
+    Q_PROPERTY(quint64 reconnects READ reconnects NOTIFY countersChanged)
+    Q_PROPERTY(qint64 lastRecoveryTime READ lastRecoveryTime
+               NOTIFY countersChanged)
+    Q_PROPERTY(qint64 maxRecoveryTime READ maxRecoveryTime
+               NOTIFY countersChanged)
+public:
+    explicit j1939Recovery(QObject *parent = nullptr);
+
+    bool errorFrame(const QCanBusFrame &frame);
+    void deviceError(QCanBusDevice::CanBusError error);
+    void fault(const QString &reason);
+    void attemptFailed();
+    void recovered();
+
+    bool recovering() const;
+    quint64 errorFrames() const;
+    quint64 deviceErrors() const;
+    quint64 busOffs() const;
+    quint64 overflows() const;
+    quint64 reconnects() const;
+    qint64 lastRecoveryTime() const;
+    qint64 maxRecoveryTime() const;
+
+signals:
+    void reconnect();
+    void countersChanged();
+
+private:
+    QTimer m_backoffTimer;
+    QElapsedTimer m_recoveryTimer;
+    int m_backoff = RECONNECT_BACKOFF_MIN_MS;
+    bool m_recovering = false;
+
+    quint64 m_errorFrames = 0;
+    quint64 m_deviceErrors = 0;
+    quint64 m_busOffs = 0;
+    quint64 m_overflows = 0;
+    quint64 m_reconnects = 0;
+    qint64 m_lastRecoveryTime = 0;
+    qint64 m_maxRecoveryTime = 0;
+};
+
+#endif // J1939_RECOVERY_H
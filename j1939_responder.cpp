@@ -0,0 +1,214 @@
+#include "j1939_responder.h"
+#include "j1939.h"
+
+/******************************************************************************
+* FUNCTION: j1939Responder()
+*
+* DESCRIPTION: This is the constructor of the class, it sets up the timer used
+*              to pace the TP.DT packets of a broadcast session.
+*
+* PARAMETERS:  bus- the j1939 instance that encodes the response payloads.
+*
+* Return:      None
+******************************************************************************/
+j1939Responder::j1939Responder(j1939 *bus, QObject *parent)
+    : QObject(parent), m_bus(bus) {
+    m_tpTimer.setInterval(TP_BAM_PACKET_INTERVAL_MS);
+    connect(&m_tpTimer, &QTimer::timeout,
+            this, &j1939Responder::sendNextPacket);
+}
+
+/******************************************************************************
+* FUNCTION: j1939Responder::handleRequest()
+*
+* DESCRIPTION: This function answers a Request PGN frame addressed to this ECU
+*              or to the global address. Known PGNs are answered from the
+*              cache, unknown ones are NACKed when the request was destination
+*              specific.
+*
+* PARAMETERS:  frame- the received Request PGN frame.
+*
+* Return:      true if the frame was a request for this ECU.
+******************************************************************************/
+bool j1939Responder::handleRequest(const QCanBusFrame &frame) {
+    quint32 canId = frame.frameId();
+    quint8 PDUFormat = (canId & PDU_FORMAT_MASK) >> PDU_FORMAT_SHIFT_POSITION;
+    quint8 destination = (canId & PDU_SPECIFIC_MASK) >> PGN_SHIFT_POSITION;
+    quint8 requester = (canId & SOURCE_ADRESS_MASK);
+    QByteArray payload = frame.payload();
+
+    if (PDUFormat != (REQUEST_PGN >> PGN_SHIFT_POSITION) ||
+            payload.size() < REQUEST_PGN_LENGTH)
+        return false;
+    if (destination != ECU_SOURCE_ADDRESS && destination != GLOBAL_ADR)
+        return false;
+
+    quint32 PGN = quint32(quint8(payload.at(0))) |
+            quint32(quint8(payload.at(1))) << 8 |
+            quint32(quint8(payload.at(2))) << 16;
+
+    if (!m_cache.contains(PGN)) {
+        QVector<QCanBusFrame> frames = encodeResponse(PGN);
+        if (frames.isEmpty()) {
+            if (destination != GLOBAL_ADR)
+                emit sendFrame(prepareNack(PGN, requester));
+            return true;
+        }
+        m_cache.insert(PGN, frames);
+    }
+
+    const QVector<QCanBusFrame> &frames = m_cache[PGN];
+    if (frames.size() == 1) {
+        emit sendFrame(frames.first());
+        return true;
+    }
+
+    // A session of this PGN still being sent answers this request too.
+    if (sessionPending(PGN))
+        return true;
+
+    // Only one BAM session may be open at a time, so a new announce waits
+    // behind the packets of the previous session.
+    bool idle = m_tpPending.isEmpty();
+    for (int i = 0; i < frames.size(); i++) {
+        if (idle && i == 0) {
+            emit sendFrame(frames.at(i));
+        } else {
+            TpPacket packet = {PGN, frames.at(i)};
+            m_tpPending.enqueue(packet);
+        }
+    }
+    if (!m_tpTimer.isActive())
+        m_tpTimer.start();
+    //qDebug() << "Request for PGN" << PGN << "from" << requester;
+    return true;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Responder::invalidate()
+*
+* DESCRIPTION: This function drops the cached response of a PGN, it must be
+*              called every time the data behind that PGN changes.
+*
+* PARAMETERS:  PGN- the PGN whose response is outdated.
+*
+* Return:      None
+******************************************************************************/
+void j1939Responder::invalidate(quint32 PGN) {
+    m_cache.remove(PGN);
+}
+
+void j1939Responder::invalidateAll() {
+    m_cache.clear();
+}
+
+/******************************************************************************
+* FUNCTION: j1939Responder::sendNextPacket()
+*
+* DESCRIPTION: This function is executed by the TP timer and releases the next
+*              pending frame of the open broadcast session.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939Responder::sendNextPacket() {
+    if (m_tpPending.isEmpty()) {
+        m_tpTimer.stop();
+        return;
+    }
+    emit sendFrame(m_tpPending.dequeue().frame);
+}
+
+/******************************************************************************
+* FUNCTION: j1939Responder::sessionPending()
+*
+* DESCRIPTION: This function tells if a broadcast session of a PGN is open or
+*              waiting, i.e. some of its frames are not sent yet.
+*
+* PARAMETERS:  PGN- the PGN of the session.
+*
+* Return:      true if a session of the PGN is pending.
+******************************************************************************/
+bool j1939Responder::sessionPending(quint32 PGN) const {
+    for (int i = 0; i < m_tpPending.size(); i++) {
+        if (m_tpPending.at(i).PGN == PGN)
+            return true;
+    }
+    return false;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Responder::encodeResponse()
+*
+* DESCRIPTION: This function asks the j1939 instance for the payload of a PGN
+*              and turns it into the frames that answer a request: a single
+*              frame when it fits in 8 bytes, or a TP.BAM announce followed by
+*              its TP.DT packets.
+*
+* PARAMETERS:  PGN- the requested PGN.
+*
+* Return:      The response frames, empty if the PGN is not supported.
+******************************************************************************/
+QVector<QCanBusFrame> j1939Responder::encodeResponse(quint32 PGN) {
+    QVector<QCanBusFrame> frames;
+    bool ok = false;
+    QByteArray data = m_bus->encodePGN(PGN, &ok);
+
+    if (!ok || data.size() > TP_MAX_MESSAGE_SIZE)
+        return frames;
+
+    if (data.size() <= BYTE_DATA_PER_PACKET) {
+        data.append(QByteArray(BYTE_DATA_PER_PACKET - data.size(), char(0xFF)));
+        frames.append(m_bus->prepareCANFrame(quint16(PGN), ECU_SOURCE_ADDRESS,
+                                             data));
+        return frames;
+    }
+
+    int packets = (data.size() + TP_BYTES_PER_PACKET - 1) / TP_BYTES_PER_PACKET;
+    QByteArray announce(BYTE_DATA_PER_PACKET, char(0xFF));
+    announce[0] = char(TP_CM_BAM);
+    announce[1] = char(data.size() & 0xFF);
+    announce[2] = char(data.size() >> 8);
+    announce[3] = char(packets);
+    announce[5] = char(PGN & 0xFF);
+    announce[6] = char((PGN >> 8) & 0xFF);
+    announce[7] = char((PGN >> 16) & 0xFF);
+    frames.append(m_bus->prepareCANFrame(TP_CM_PGN | GLOBAL_ADR,
+                                         ECU_SOURCE_ADDRESS, announce));
+
+    for (int i = 0; i < packets; i++) {
+        QByteArray packet(BYTE_DATA_PER_PACKET, char(0xFF));
+        packet[0] = char(i + 1);
+        for (int j = 0; j < TP_BYTES_PER_PACKET; j++) {
+            int pos = i * TP_BYTES_PER_PACKET + j;
+            if (pos < data.size())
+                packet[j + 1] = data.at(pos);
+        }
+        frames.append(m_bus->prepareCANFrame(TP_DT_PGN | GLOBAL_ADR,
+                                             ECU_SOURCE_ADDRESS, packet));
+    }
+    return frames;
+}
+
+/******************************************************************************
+* FUNCTION: j1939Responder::prepareNack()
+*
+* DESCRIPTION: This function builds the negative acknowledgement sent when a
+*              destination specific request asks for an unsupported PGN.
+*
+* PARAMETERS:  PGN- the requested PGN.
+*              addr- the address of the requester.
+*
+* Return:      The NACK frame.
+******************************************************************************/
+QCanBusFrame j1939Responder::prepareNack(quint32 PGN, quint8 addr) {
+    QByteArray payload(BYTE_DATA_PER_PACKET, char(0xFF));
+    payload[0] = char(ACK_CONTROL_NACK);
+    payload[4] = char(addr);
+    payload[5] = char(PGN & 0xFF);
+    payload[6] = char((PGN >> 8) & 0xFF);
+    payload[7] = char((PGN >> 16) & 0xFF);
+    return m_bus->prepareCANFrame(ACK_PGN | GLOBAL_ADR, ECU_SOURCE_ADDRESS,
+                                  payload);
+}
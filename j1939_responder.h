@@ -0,0 +1,68 @@
+#ifndef J1939_RESPONDER_H
+#define J1939_RESPONDER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QCanBusFrame>
+#include <QHash>
+#include <QObject>
+#include <QQueue>
+#include <QTimer>
+#include <QVector>
+#include "j1939_config.h"
+
+class j1939;
+
+/******************************************************************************
+ *
+ * Class: j1939Responder
+ *
+ * This class answers Request PGN (59904) messages. Responses are kept as
+ * pre-encoded CAN frames in a cache indexed by PGN, so a burst of requests
+ * from a diagnostic tool only costs a lookup. The cache entry of a PGN is
+ * dropped with invalidate() when the data behind it changes, and it is
+ * encoded again on the next request.
+ *
+ * Responses longer than 8 bytes are sent as a TP.BAM session: the announce
+ * frame goes out immediately and the data packets are released by a timer
+ * every TP_BAM_PACKET_INTERVAL_MS.
+ *
+******************************************************************************/
+
+class j1939Responder : public QObject {
+    Q_OBJECT
+public:
+    explicit j1939Responder(j1939 *bus, QObject *parent = nullptr);
+
+    bool handleRequest(const QCanBusFrame &frame);
+    void invalidate(quint32 PGN);
+    void invalidateAll();
+
+signals:
+    void sendFrame(const QCanBusFrame &frame);
+
+private slots:
+    void sendNextPacket();
+
+private:
+    QVector<QCanBusFrame> encodeResponse(quint32 PGN);
+    QCanBusFrame prepareNack(quint32 PGN, quint8 addr);
+    bool sessionPending(quint32 PGN) const;
+
+    j1939 *m_bus;
+
+    // pre-encoded responses, first frame is either the single frame
+    // response or the TP.BAM announce followed by its TP.DT packets
+    QHash<quint32, QVector<QCanBusFrame>> m_cache;
+
+    // TP.DT packets waiting to be released by m_tpTimer, with the PGN of
+    // their session
+    struct TpPacket {
+        quint32 PGN;
+        QCanBusFrame frame;
+    };
+    QQueue<TpPacket> m_tpPending;
+    QTimer m_tpTimer;
+};
+
+#endif // J1939_RESPONDER_H
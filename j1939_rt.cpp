@@ -0,0 +1,220 @@
+#include "j1939_rt.h"
+#include <QStringList>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/******************************************************************************
+* FUNCTION: rtProfileFromEnv()
+*
+* DESCRIPTION: This function reads the real-time profile from JD_RT_PROFILE,
+*              JD_RT_CPU and JD_RT_PRIORITY.
+*
+* PARAMETERS:  None
+*
+* Return:      The profile, disabled unless JD_RT_PROFILE is 1.
+******************************************************************************/
+j1939RtProfile rtProfileFromEnv() {
+    j1939RtProfile profile;
+    profile.enabled = qgetenv(RT_PROFILE_ENV) == "1";
+
+    bool ok = false;
+    int cpu = qgetenv(RT_CPU_ENV).toInt(&ok);
+    if (ok && cpu >= 0)
+        profile.cpu = cpu;
+    int priority = qgetenv(RT_PRIORITY_ENV).toInt(&ok);
+    if (ok && priority >= sched_get_priority_min(SCHED_FIFO) &&
+            priority <= sched_get_priority_max(SCHED_FIFO))
+        profile.priority = priority;
+    return profile;
+}
+
+/******************************************************************************
+* FUNCTION: applyRtProfile()
+*
+* DESCRIPTION: This function moves the calling thread to SCHED_FIFO, pins it
+*              to the profile CPU and locks the memory of the process, so the
+*              receive path is not delayed by other threads, migrations or
+*              page faults. The stack of the thread is prefaulted.
+*
+* PARAMETERS:  profile- the profile to apply.
+*              error- set to the steps that failed, if any.
+*
+* Return:      true if every step was applied.
+******************************************************************************/
+bool applyRtProfile(const j1939RtProfile &profile, QString *error) {
+    QStringList errors;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        errors << QStringLiteral("mlockall: %1").arg(strerror(errno));
+
+    if (profile.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(profile.cpu, &set);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (result != 0)
+            errors << QStringLiteral("affinity to CPU %1: %2")
+                      .arg(profile.cpu).arg(strerror(result));
+    }
+
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = profile.priority;
+    int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (result != 0)
+        errors << QStringLiteral("SCHED_FIFO %1: %2")
+                  .arg(profile.priority).arg(strerror(result));
+
+    prefaultStack();
+
+    if (error)
+        *error = errors.join(QStringLiteral(", "));
+    return errors.isEmpty();
+}
+
+/******************************************************************************
+* FUNCTION: prefaultStack() / prefault()
+*
+* DESCRIPTION: These functions touch every page of the stack of the calling
+*              thread, up to RT_PREFAULT_STACK bytes, or of a buffer. With the
+*              memory locked the pages then stay resident.
+*
+* PARAMETERS:  buffer- the buffer to prefault.
+*              size- its size in bytes.
+*
+* Return:      None
+******************************************************************************/
+void prefaultStack() {
+    char stack[RT_PREFAULT_STACK];
+    prefault(stack, sizeof(stack));
+}
+
+void prefault(void *buffer, size_t size) {
+    volatile char *bytes = static_cast<volatile char *>(buffer);
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    for (size_t i = 0; i < size; i += page)
+        bytes[i] = bytes[i];
+    if (size)
+        bytes[size - 1] = bytes[size - 1];
+}
+
+qint64 realtimeMicros() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return qint64(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+/******************************************************************************
+* FUNCTION: j1939LatencyStats()
+*
+* DESCRIPTION: This is the constructor of the class.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+j1939LatencyStats::j1939LatencyStats() {
+    reset();
+}
+
+/******************************************************************************
+* FUNCTION: j1939LatencyStats::record()
+*
+* DESCRIPTION: This function adds the latency of a frame. Bucket i holds the
+*              latencies below 2^i us, the last one everything above.
+*
+* PARAMETERS:  latency- the receive-to-decode latency, in us.
+*
+* Return:      None
+******************************************************************************/
+void j1939LatencyStats::record(qint64 latency) {
+    if (latency < 0)
+        latency = 0;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (qint64(1) << bucket) <= latency)
+        bucket++;
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(latency, std::memory_order_relaxed);
+    if (latency > m_max.load(std::memory_order_relaxed))
+        m_max.store(latency, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_release);
+}
+
+void j1939LatencyStats::reset() {
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_release);
+}
+
+quint64 j1939LatencyStats::count() const {
+    return m_count.load(std::memory_order_acquire);
+}
+
+qint64 j1939LatencyStats::max() const {
+    return m_max.load(std::memory_order_relaxed);
+}
+
+qint64 j1939LatencyStats::mean() const {
+    quint64 frames = count();
+    return frames ? m_sum.load(std::memory_order_relaxed) / qint64(frames) : 0;
+}
+
+/******************************************************************************
+* FUNCTION: j1939LatencyStats::percentile()
+*
+* DESCRIPTION: This function gives the upper bound of the bucket that holds a
+*              percentile of the latencies, or the max if it is lower.
+*
+* PARAMETERS:  fraction- the percentile, e.g. 0.99.
+*
+* Return:      The bound in us, 0 if nothing was recorded.
+******************************************************************************/
+qint64 j1939LatencyStats::percentile(double fraction) const {
+    quint64 frames = count();
+    if (!frames)
+        return 0;
+    quint64 target = quint64(fraction * frames);
+    quint64 seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen > target)
+            return qMin(qint64(1) << i, max());
+    }
+    return max();
+}
+
+/******************************************************************************
+* FUNCTION: j1939LatencyStats::report()
+*
+* DESCRIPTION: This function formats the jitter report: the summary line and
+*              the histogram of the non empty buckets.
+*
+* PARAMETERS:  label- name of the measurement, e.g. the profile.
+*
+* Return:      The report.
+******************************************************************************/
+QString j1939LatencyStats::report(const QString &label) const {
+    QString text = QStringLiteral("%1: %2 frames, mean %3 us, p99 <= %4 us, "
+                                  "p99.99 <= %5 us, max %6 us\n")
+            .arg(label).arg(count()).arg(mean()).arg(percentile(0.99))
+            .arg(percentile(0.9999)).arg(max());
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        quint64 frames = m_buckets[i].load(std::memory_order_relaxed);
+        if (!frames)
+            continue;
+        if (i == LATENCY_BUCKETS - 1)
+            text += QStringLiteral("  >= %1 us: %2\n")
+                    .arg(qint64(1) << (i - 1)).arg(frames);
+        else
+            text += QStringLiteral("  < %1 us: %2\n")
+                    .arg(qint64(1) << i).arg(frames);
+    }
+    return text;
+}
@@ -0,0 +1,69 @@
+#ifndef J1939_RT_H
+#define J1939_RT_H
+
+#include <QtGlobal>
+#include <QString>
+#include <atomic>
+#include "j1939_config.h"
+
+/******************************************************************************
+ *
+ * Real-time profile
+ *
+ * The profile is read from the environment:
+ *
+ *   JD_RT_PROFILE=1    enable it
+ *   JD_RT_CPU=<n>      pin the receive thread to CPU n
+ *   JD_RT_PRIORITY=<n> SCHED_FIFO priority, default RT_PRIORITY
+ *
+ * applyRtProfile() is called by the thread that receives and decodes the
+ * frames. It needs CAP_SYS_NICE and CAP_IPC_LOCK, or matching rtprio and
+ * memlock limits; what could not be applied is reported in error and the
+ * thread carries on with what was.
+ *
+******************************************************************************/
+
+struct j1939RtProfile {
+    bool enabled = false;
+    int priority = RT_PRIORITY;
+    int cpu = -1;
+};
+
+j1939RtProfile rtProfileFromEnv();
+bool applyRtProfile(const j1939RtProfile &profile, QString *error);
+void prefaultStack();
+void prefault(void *buffer, size_t size);
+qint64 realtimeMicros();
+
+/******************************************************************************
+ *
+ * Class: j1939LatencyStats
+ *
+ * This class keeps the receive-to-decode latency of the frames: the time
+ * from the kernel timestamp of a frame to the end of its decode. Latencies
+ * are kept in power of two buckets of us. record() is called by one thread,
+ * the report can be read from any other.
+ *
+******************************************************************************/
+
+class j1939LatencyStats {
+public:
+    j1939LatencyStats();
+
+    void record(qint64 latency);
+    void reset();
+
+    quint64 count() const;
+    qint64 max() const;
+    qint64 mean() const;
+    qint64 percentile(double fraction) const;
+    QString report(const QString &label) const;
+
+private:
+    std::atomic<quint64> m_buckets[LATENCY_BUCKETS];
+    std::atomic<quint64> m_count;
+    std::atomic<qint64> m_sum;
+    std::atomic<qint64> m_max;
+};
+
+#endif // J1939_RT_H
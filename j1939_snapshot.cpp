@@ -0,0 +1,303 @@
+#include "j1939_snapshot.h"
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/******************************************************************************
+* FUNCTION: snapshotCrc()
+*
+* DESCRIPTION: This function computes the CRC-32 (IEEE 802.3) of a buffer.
+*
+* PARAMETERS:  data- the buffer.
+*              size- its size in bytes.
+*
+* Return:      The CRC.
+******************************************************************************/
+quint32 snapshotCrc(const char *data, size_t size) {
+    static quint32 table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+            table[i] = crc;
+        }
+        ready = true;
+    }
+
+    quint32 crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ quint8(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
+
+/******************************************************************************
+* FUNCTION: encodeSnapshot()
+*
+* DESCRIPTION: This function builds the snapshot file: header, state and the
+*              entries of the active and previously active DTC stores.
+*
+* PARAMETERS:  snapshot- the state to encode.
+*
+* Return:      The file contents.
+******************************************************************************/
+QByteArray encodeSnapshot(const j1939Snapshot &snapshot) {
+    SnapshotState state = snapshot.state;
+    state.DTCCount = quint16(snapshot.activeDTCs.size() +
+                             snapshot.previousDTCs.size());
+
+    QByteArray body(reinterpret_cast<const char *>(&state), sizeof(state));
+    const QMap<quint8, QByteArray> *stores[] = {&snapshot.activeDTCs,
+                                                &snapshot.previousDTCs};
+    for (int previous = 0; previous < 2; previous++) {
+        for (QMap<quint8, QByteArray>::const_iterator it =
+             stores[previous]->constBegin();
+             it != stores[previous]->constEnd(); ++it) {
+            SnapshotDTC entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.address = it.key();
+            entry.previous = quint8(previous);
+            memcpy(entry.DTC, it.value().constData(),
+                   size_t(qMin(it.value().size(), DTC_LENGTH)));
+            body.append(reinterpret_cast<const char *>(&entry),
+                        sizeof(entry));
+        }
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.reserved = 0;
+    header.size = quint32(body.size());
+    header.crc = snapshotCrc(body.constData(), size_t(body.size()));
+    return QByteArray(reinterpret_cast<const char *>(&header),
+                      sizeof(header)) + body;
+}
+
+/******************************************************************************
+* FUNCTION: decodeSnapshot()
+*
+* DESCRIPTION: This function validates a snapshot file, magic, version, size
+*              and CRC, and reads the state out of it.
+*
+* PARAMETERS:  data- the file contents.
+*              size- the file size.
+*              snapshot- the decoded state, only written if valid.
+*
+* Return:      False if the snapshot is not valid.
+******************************************************************************/
+bool decodeSnapshot(const char *data, size_t size, j1939Snapshot *snapshot) {
+    SnapshotHeader header;
+    SnapshotState state;
+    if (size < sizeof(header) + sizeof(state))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SNAPSHOT_VERSION ||
+            header.size != size - sizeof(header))
+        return false;
+    const char *body = data + sizeof(header);
+    if (snapshotCrc(body, header.size) != header.crc)
+        return false;
+
+    memcpy(&state, body, sizeof(state));
+    if (header.size != sizeof(state) + state.DTCCount * sizeof(SnapshotDTC))
+        return false;
+
+    snapshot->state = state;
+    snapshot->activeDTCs.clear();
+    snapshot->previousDTCs.clear();
+    for (int i = 0; i < state.DTCCount; i++) {
+        SnapshotDTC entry;
+        memcpy(&entry, body + sizeof(state) + i * sizeof(entry),
+               sizeof(entry));
+        QByteArray DTC(reinterpret_cast<const char *>(entry.DTC),
+                       DTC_LENGTH);
+        if (entry.previous)
+            snapshot->previousDTCs.insert(entry.address, DTC);
+        else
+            snapshot->activeDTCs.insert(entry.address, DTC);
+    }
+    return true;
+}
+
+/******************************************************************************
+* FUNCTION: loadSnapshot()
+*
+* DESCRIPTION: This function maps a snapshot file and decodes it. Nothing is
+*              copied until the file is validated.
+*
+* PARAMETERS:  path- the snapshot file.
+*              snapshot- the decoded state, only written if valid.
+*              error- set with the reason when the snapshot is not loaded.
+*
+* Return:      True if the snapshot was loaded.
+******************************************************************************/
+bool loadSnapshot(const QString &path, j1939Snapshot *snapshot,
+                  QString *error) {
+    int fd = open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size <= 0) {
+        *error = QStringLiteral("empty file");
+        close(fd);
+        return false;
+    }
+
+    size_t size = size_t(info.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+    bool valid = decodeSnapshot(static_cast<const char *>(data), size,
+                                snapshot);
+    munmap(data, size);
+    if (!valid)
+        *error = QStringLiteral("not a valid snapshot");
+    return valid;
+}
+
+/******************************************************************************
+* FUNCTION: j1939SnapshotWriter()
+*
+* DESCRIPTION: This is the constructor of the class. The thread is started by
+*              the owner.
+*
+* PARAMETERS:  path- the snapshot file.
+*              parent- the QObject parent.
+*
+* Return:      None
+******************************************************************************/
+j1939SnapshotWriter::j1939SnapshotWriter(const QString &path, QObject *parent)
+    : QThread(parent), m_path(path) {
+}
+
+j1939SnapshotWriter::~j1939SnapshotWriter() {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        m_wake.wakeOne();
+    }
+    wait();
+}
+
+/******************************************************************************
+* FUNCTION: j1939SnapshotWriter::submit()
+*
+* DESCRIPTION: This function hands a snapshot to the thread. It replaces the
+*              pending one if it was not written yet.
+*
+* PARAMETERS:  snapshot- the file contents, see encodeSnapshot().
+*
+* Return:      None
+******************************************************************************/
+void j1939SnapshotWriter::submit(const QByteArray &snapshot) {
+    QMutexLocker locker(&m_mutex);
+    m_pending = snapshot;
+    m_wake.wakeOne();
+}
+
+/******************************************************************************
+* FUNCTION: j1939SnapshotWriter::run()
+*
+* DESCRIPTION: This is the write loop, it waits for a snapshot and writes it
+*              outside the lock. Failures are reported once until a write
+*              succeeds again.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939SnapshotWriter::run() {
+    bool reported = false;
+    QMutexLocker locker(&m_mutex);
+    forever {
+        while (m_pending.isEmpty() && !m_stop)
+            m_wake.wait(&m_mutex);
+        if (m_pending.isEmpty())
+            break;
+        QByteArray snapshot = m_pending;
+        m_pending.clear();
+
+        locker.unlock();
+        QString error;
+        if (writeFile(snapshot, &error)) {
+            reported = false;
+        } else if (!reported) {
+            qDebug() << "Can't write snapshot" << m_path << error;
+            reported = true;
+        }
+        locker.relock();
+    }
+}
+
+/******************************************************************************
+* FUNCTION: j1939SnapshotWriter::writeFile()
+*
+* DESCRIPTION: This function replaces the snapshot file: the data is written
+*              and synced to a temporary file in the same directory, which is
+*              renamed over the snapshot, and the directory is synced.
+*
+* PARAMETERS:  snapshot- the file contents.
+*              error- set with the reason of a failure.
+*
+* Return:      True if the snapshot was replaced.
+******************************************************************************/
+bool j1939SnapshotWriter::writeFile(const QByteArray &snapshot,
+                                    QString *error) {
+    QByteArray path = QFile::encodeName(m_path);
+    QByteArray temporary = path + ".tmp";
+    int fd = open(temporary.constData(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    const char *data = snapshot.constData();
+    size_t left = size_t(snapshot.size());
+    while (left) {
+        ssize_t written = write(fd, data, left);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+        data += written;
+        left -= size_t(written);
+    }
+    if (left || fsync(fd) < 0) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        close(fd);
+        unlink(temporary.constData());
+        return false;
+    }
+    close(fd);
+    if (rename(temporary.constData(), path.constData()) < 0) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        unlink(temporary.constData());
+        return false;
+    }
+
+    // the rename is only durable once the directory is synced
+    QByteArray directory = QFile::encodeName(
+                QFileInfo(m_path).absolutePath());
+    int dir = open(directory.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return true;
+}
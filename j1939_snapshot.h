@@ -0,0 +1,118 @@
+#ifndef J1939_SNAPSHOT_H
+#define J1939_SNAPSHOT_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include "j1939_config.h"
+#include "j1939_archive.h"
+
+/******************************************************************************
+ *
+ * Warm-start snapshot
+ *
+ * The snapshot keeps the last known state of the dashboard: the newest value
+ * of every measurement signal, the setpoints, the fault fields, the DTC
+ * stores and the table of source addresses heard on the bus. It is loaded at
+ * startup so the gauges show the last known state before any traffic.
+ *
+ * File layout, host byte order:
+ *
+ *   SnapshotHeader  "JDS1", version, body size, CRC-32 of the body
+ *   SnapshotState   fixed size part of the state
+ *   SnapshotDTC*    SnapshotState::DTCCount entries of both DTC stores
+ *
+ * The file is replaced atomically, a snapshot is either the old or the new
+ * one. A file with another magic, version or size, or a bad CRC, is ignored.
+ *
+******************************************************************************/
+
+enum SnapshotFault_E {
+    F_TACHOMETER,
+    F_FUEL_GAUGE,
+    F_THERMOMETER,
+    F_LINEAR,
+    F_TEMPERATURE,
+    F_POSITION,
+    F_COUNT
+};
+
+#pragma pack(push, 1)
+struct SnapshotHeader {
+    char magic[4];
+    quint16 version;
+    quint16 reserved;
+    quint32 size;
+    quint32 crc;
+};
+
+struct SnapshotState {
+    // time 0 for a signal not received yet
+    qint64 time[A_SIGNAL_COUNT];
+    double value[A_SIGNAL_COUNT];
+    quint8 tempSP;
+    quint8 linearSP;
+    quint8 faultStates[F_COUNT];
+    quint8 newFaults[F_COUNT];
+    // one bit per source address
+    quint8 addresses[SNAPSHOT_ADDRESS_BYTES];
+    quint16 DTCCount;
+};
+
+struct SnapshotDTC {
+    quint8 address;
+    quint8 previous;
+    quint8 DTC[DTC_LENGTH];
+};
+#pragma pack(pop)
+
+struct j1939Snapshot {
+    SnapshotState state;
+    QMap<quint8, QByteArray> activeDTCs;
+    QMap<quint8, QByteArray> previousDTCs;
+};
+
+quint32 snapshotCrc(const char *data, size_t size);
+QByteArray encodeSnapshot(const j1939Snapshot &snapshot);
+bool decodeSnapshot(const char *data, size_t size, j1939Snapshot *snapshot);
+bool loadSnapshot(const QString &path, j1939Snapshot *snapshot,
+                  QString *error);
+
+/******************************************************************************
+ *
+ * Class: j1939SnapshotWriter
+ *
+ * This thread writes the snapshots handed with submit(): to a temporary file
+ * that is synced and renamed over the snapshot. Only the newest pending
+ * snapshot is written, the owner thread never waits for the disk. The
+ * pending snapshot is written before the thread ends.
+ *
+******************************************************************************/
+
+class j1939SnapshotWriter : public QThread {
+    Q_OBJECT
+public:
+    explicit j1939SnapshotWriter(const QString &path,
+                                 QObject *parent = nullptr);
+    ~j1939SnapshotWriter();
+
+    void submit(const QByteArray &snapshot);
+
+protected:
+    void run() override;
+
+private:
+    bool writeFile(const QByteArray &snapshot, QString *error);
+
+    QString m_path;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QByteArray m_pending;
+    bool m_stop = false;
+};
+
+#endif // J1939_SNAPSHOT_H
@@ -0,0 +1,248 @@
+#include "j1939_txscheduler.h"
+#include <QMetaObject>
+#include <chrono>
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler()
+*
+* DESCRIPTION: This is the constructor of the class, it creates one queue per
+*              J1939 priority and fills the token bucket.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+j1939TxScheduler::j1939TxScheduler(QObject *parent)
+    : QObject(parent), m_flushScheduled(false) {
+    for (int i = 0; i < TX_PRIORITY_LEVELS; i++) {
+        m_queues[i] = new j1939Queue<Entry>(TX_QUEUE_DEPTH);
+        m_hasHeld[i] = false;
+    }
+    resetCounters();
+    setBusLoadCeiling(TX_BUS_LOAD_CEILING_PCT);
+    m_tokens = m_capacity;
+    m_lastRefill = now();
+
+    m_shapingTimer.setSingleShot(true);
+    m_shapingTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_shapingTimer, &QTimer::timeout,
+            this, &j1939TxScheduler::flush);
+}
+
+j1939TxScheduler::~j1939TxScheduler() {
+    for (int i = 0; i < TX_PRIORITY_LEVELS; i++)
+        delete m_queues[i];
+}
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler::setDevice()
+*
+* DESCRIPTION: This function sets the device the frames are written to, and
+*              drains the frames queued while there was no device.
+*
+* PARAMETERS:  device- the connected CAN device, may be null.
+*
+* Return:      None
+******************************************************************************/
+void j1939TxScheduler::setDevice(QCanBusDevice *device) {
+    if (m_device)
+        disconnect(m_device, nullptr, this, nullptr);
+    m_device = device;
+    if (!m_device)
+        return;
+    connect(m_device, &QCanBusDevice::framesWritten,
+            this, &j1939TxScheduler::flush);
+    scheduleFlush();
+}
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler::enqueue()
+*
+* DESCRIPTION: This function queues a frame by the priority in its id. It may
+*              be called from any thread. Enqueues made before the next flush
+*              are written in the same batch.
+*
+* PARAMETERS:  frame- the frame to send.
+*
+* Return:      false if the queue of that priority is full.
+******************************************************************************/
+bool j1939TxScheduler::enqueue(const QCanBusFrame &frame) {
+    int priority = (frame.frameId() & ID_PRIORITY_MASK) >> PRIORITY_SHIFT_POSITION;
+    Entry entry;
+    entry.frame = frame;
+    entry.queued = now();
+
+    if (!m_queues[priority]->push(entry)) {
+        m_counters[priority].dropped++;
+        return false;
+    }
+    scheduleFlush();
+    return true;
+}
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler::flush()
+*
+* DESCRIPTION: This function writes up to TX_BATCH_SIZE frames, highest
+*              priority first. It stops when the device backlog is full, and
+*              waits for the framesWritten signal, or when the token bucket is
+*              empty, and waits for the shaping timer.
+*
+* PARAMETERS:  None
+*
+* Return:      None
+******************************************************************************/
+void j1939TxScheduler::flush() {
+    m_flushScheduled = false;
+    if (!m_device || m_device->state() != QCanBusDevice::ConnectedState)
+        return;
+
+    refill();
+    int written = 0;
+    for (int priority = 0; priority < TX_PRIORITY_LEVELS;) {
+        // a full batch yields to the event loop, a full device backlog
+        // waits for framesWritten
+        if (written == TX_BATCH_SIZE) {
+            scheduleFlush();
+            return;
+        }
+        if (m_device->framesToWrite() >= TX_DEVICE_BACKLOG)
+            return;
+
+        if (!m_hasHeld[priority])
+            m_hasHeld[priority] = m_queues[priority]->pop(m_held[priority]);
+        if (!m_hasHeld[priority]) {
+            priority++;
+            continue;
+        }
+
+        Entry &entry = m_held[priority];
+        int bits = frameBits(entry.frame);
+        if (priority > TX_UNSHAPED_PRIORITY && m_tokens < bits) {
+            qint64 wait = qint64((bits - m_tokens) * 1000 / m_rate) + 1;
+            if (!m_shapingTimer.isActive())
+                m_shapingTimer.start(int(wait));
+            return;
+        }
+
+        m_tokens -= bits;
+        Counters &counters = m_counters[priority];
+        emit frameWriting(entry.frame);
+        if (m_device->writeFrame(entry.frame)) {
+            quint64 latency = quint64(now() - entry.queued) / 1000;
+            counters.sent++;
+            counters.totalLatency += latency;
+            qint64 max = counters.maxLatency.load();
+            while (qint64(latency) > max &&
+                   !counters.maxLatency.compare_exchange_weak(max, latency)) {
+            }
+        } else {
+            counters.dropped++;
+            emit frameNotWritten(entry.frame);
+        }
+        m_held[priority] = Entry();
+        m_hasHeld[priority] = false;
+        written++;
+    }
+}
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler::setBusLoadCeiling()
+*
+* DESCRIPTION: This function sets the share of the bus bandwidth the shaped
+*              traffic may use. The bucket holds TX_BURST_FRAMES full frames.
+*
+* PARAMETERS:  percent- bus load ceiling, 1 to 100.
+*
+* Return:      None
+******************************************************************************/
+void j1939TxScheduler::setBusLoadCeiling(int percent) {
+    percent = qBound(1, percent, 100);
+    m_rate = double(TX_BUS_BITRATE) * percent / 100;
+    m_capacity = double(TX_BURST_FRAMES) * frameBits(
+                QCanBusFrame(0, QByteArray(BYTE_DATA_PER_PACKET, 0)));
+}
+
+int j1939TxScheduler::queueDepth(int priority) const {
+    if (priority < 0 || priority >= TX_PRIORITY_LEVELS)
+        return 0;
+    return int(m_queues[priority]->size()) + (m_hasHeld[priority] ? 1 : 0);
+}
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler::maxLatency()
+*
+* DESCRIPTION: This function gives the longest time a frame of the priority
+*              waited between enqueue() and its write to the device.
+*
+* PARAMETERS:  priority- J1939 priority, 0 to 7.
+*
+* Return:      The latency in microseconds.
+******************************************************************************/
+qint64 j1939TxScheduler::maxLatency(int priority) const {
+    if (priority < 0 || priority >= TX_PRIORITY_LEVELS)
+        return 0;
+    return m_counters[priority].maxLatency.load();
+}
+
+qint64 j1939TxScheduler::meanLatency(int priority) const {
+    if (priority < 0 || priority >= TX_PRIORITY_LEVELS)
+        return 0;
+    quint64 sent = m_counters[priority].sent.load();
+    if (sent == 0)
+        return 0;
+    return qint64(m_counters[priority].totalLatency.load() / sent);
+}
+
+quint64 j1939TxScheduler::sentFrames(int priority) const {
+    if (priority < 0 || priority >= TX_PRIORITY_LEVELS)
+        return 0;
+    return m_counters[priority].sent.load();
+}
+
+quint64 j1939TxScheduler::droppedFrames(int priority) const {
+    if (priority < 0 || priority >= TX_PRIORITY_LEVELS)
+        return 0;
+    return m_counters[priority].dropped.load();
+}
+
+void j1939TxScheduler::resetCounters() {
+    for (int i = 0; i < TX_PRIORITY_LEVELS; i++) {
+        m_counters[i].sent = 0;
+        m_counters[i].dropped = 0;
+        m_counters[i].totalLatency = 0;
+        m_counters[i].maxLatency = 0;
+    }
+}
+
+void j1939TxScheduler::refill() {
+    qint64 time = now();
+    m_tokens = qMin(m_capacity,
+                    m_tokens + (time - m_lastRefill) * m_rate / 1e9);
+    m_lastRefill = time;
+}
+
+void j1939TxScheduler::scheduleFlush() {
+    if (!m_flushScheduled.exchange(true))
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+}
+
+qint64 j1939TxScheduler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/******************************************************************************
+* FUNCTION: j1939TxScheduler::frameBits()
+*
+* DESCRIPTION: This function estimates the bus time of an extended frame,
+*              worst case bit stuffing and interframe space included.
+*
+* PARAMETERS:  frame- the frame to be sent.
+*
+* Return:      The number of bits.
+******************************************************************************/
+int j1939TxScheduler::frameBits(const QCanBusFrame &frame) {
+    int dataBits = 8 * frame.payload().size();
+    return 67 + dataBits + (54 + dataBits - 1) / 4 + 3;
+}
@@ -0,0 +1,97 @@
+#ifndef J1939_TXSCHEDULER_H
+#define J1939_TXSCHEDULER_H
+
+#include <QtGlobal>
+#include <QCanBusDevice>
+#include <QCanBusFrame>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <atomic>
+#include "j1939_config.h"
+#include "j1939_queue.h"
+
+/******************************************************************************
+ *
+ * Class: j1939TxScheduler
+ *
+ * This class owns every transmission to the CAN device. Frames are queued by
+ * the 3 bit J1939 priority of their id, in one lock-free queue per priority,
+ * so enqueue() can be called from any thread without blocking.
+ *
+ * The queues are drained in batches by flush() on the thread of the
+ * scheduler, highest priority first. Frames are shaped with a token bucket
+ * that refills at TX_BUS_LOAD_CEILING_PCT of the bus bitrate, so a burst of
+ * low priority traffic can't take the bus from the other nodes. Frames with
+ * priority up to TX_UNSHAPED_PRIORITY are sent even if the bucket is empty.
+ *
+ * Queue depth, sent and dropped frames, and the time spent in the queue are
+ * counted per priority. frameWriting() is emitted right before a frame is
+ * written to the device and frameNotWritten() if the device refused it, so
+ * the frames on the bus can be followed.
+ *
+******************************************************************************/
+
+class j1939TxScheduler : public QObject {
+    Q_OBJECT
+public:
+    explicit j1939TxScheduler(QObject *parent = nullptr);
+    ~j1939TxScheduler();
+
+    void setDevice(QCanBusDevice *device);
+    bool enqueue(const QCanBusFrame &frame);
+
+    Q_INVOKABLE void setBusLoadCeiling(int percent);
+    Q_INVOKABLE int queueDepth(int priority) const;
+    Q_INVOKABLE qint64 maxLatency(int priority) const;
+    Q_INVOKABLE qint64 meanLatency(int priority) const;
+    Q_INVOKABLE quint64 sentFrames(int priority) const;
+    Q_INVOKABLE quint64 droppedFrames(int priority) const;
+    Q_INVOKABLE void resetCounters();
+
+public slots:
+    void flush();
+
+signals:
+    void frameWriting(const QCanBusFrame &frame);
+    void frameNotWritten(const QCanBusFrame &frame);
+
+private:
+    struct Entry {
+        QCanBusFrame frame;
+        qint64 queued = 0;
+    };
+
+    struct Counters {
+        std::atomic<quint64> sent;
+        std::atomic<quint64> dropped;
+        std::atomic<quint64> totalLatency;
+        std::atomic<qint64> maxLatency;
+    };
+
+    static qint64 now();
+    static int frameBits(const QCanBusFrame &frame);
+
+    void refill();
+    void scheduleFlush();
+
+    j1939Queue<Entry> *m_queues[TX_PRIORITY_LEVELS];
+    Counters m_counters[TX_PRIORITY_LEVELS];
+
+    // frame popped from a queue but held back by the shaping, only touched
+    // by flush()
+    Entry m_held[TX_PRIORITY_LEVELS];
+    bool m_hasHeld[TX_PRIORITY_LEVELS];
+
+    std::atomic<bool> m_flushScheduled;
+    QPointer<QCanBusDevice> m_device;
+    QTimer m_shapingTimer;
+
+    // token bucket, in bits
+    double m_tokens;
+    double m_capacity;
+    double m_rate;
+    qint64 m_lastRefill;
+};
+
+#endif // J1939_TXSCHEDULER_H
@@ -53,7 +53,6 @@
 #include <QtGui/QFontDatabase>
 #include <QString>
 #include <QFileDialog>
-#include <QProcess>
 #include <QDebug>
 
 
@@ -61,14 +60,20 @@
 
 int main(int argc, char *argv[])
 {
-    if (QProcess::execute(QString("/bin/sh"), QStringList() <<
-                          "canSocketStarter.sh") < 0)
-        qDebug() << "Failed to open CAN Socket";
-    else
-        qDebug() << "can0 setup succesful";
+    // the CAN interface is brought up by the J1939 object while QML loads
+    j1939Link::markPhase("process start");
 
     QGuiApplication app(argc, argv);
     qmlRegisterType<j1939>("io.qt.j1939", 1, 0, "J1939");
+    qmlRegisterUncreatableType<j1939Diagnostics>("io.qt.j1939", 1, 0,
+                                                 "J1939Diagnostics",
+                                                 "Use J1939.diagnostics");
+    qmlRegisterUncreatableType<j1939TxScheduler>("io.qt.j1939", 1, 0,
+                                                 "J1939TxScheduler",
+                                                 "Use J1939.txScheduler");
+    qmlRegisterUncreatableType<j1939Recovery>("io.qt.j1939", 1, 0,
+                                              "J1939Recovery",
+                                              "Use J1939.recovery");
     //to use the J1939 class in qml
     QFont Font = QFont("Liberation Sans");
     Font.setPointSize(20);
@@ -87,5 +92,6 @@ int main(int argc, char *argv[])
 
     if (engine.rootObjects().isEmpty())
         return -1;
+    j1939Link::markPhase("qml loaded");
     return app.exec();
 }
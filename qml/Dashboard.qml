@@ -453,6 +453,26 @@ Window {
             wrapMode: Text.WordWrap
         }
 
+        //text to be displayed while the CAN interface is brought up
+        Text {
+            id: connectingText
+            visible: !j1939.Connected && !noSignaltext.visible
+
+            x: 34
+            width: 850
+            height: 438
+            anchors.verticalCenter: parent.verticalCenter
+
+            color: "#FFA500"
+            text: "Connecting..."
+            z: 2
+            anchors.verticalCenterOffset: -21
+            font.pointSize: 60
+            verticalAlignment: Text.AlignVCenter
+            horizontalAlignment: Text.AlignHCenter
+            wrapMode: Text.WordWrap
+        }
+
         Rectangle {
             id: background
             x: 40
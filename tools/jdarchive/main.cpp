@@ -0,0 +1,487 @@
+/******************************************************************************
+ *
+ * jdarchive
+ *
+ * Command line tool to inspect an archive written by the dashboard and
+ * extract signals to CSV. Only the blocks that overlap the time range are
+ * read. A candump log (candump -l) can be imported into a new archive, it
+ * is decoded in batches with j1939BatchDecoder.
+ *
+ * check writes archives to a temporary file and reads them back: special
+ * values (NaN, -0, inf), equal and decreasing timestamps, chunks at and
+ * around ARCHIVE_CHUNK_SAMPLES and ARCHIVE_CHUNK_SPAN_US, and archives cut
+ * before the index or inside a block. Every sample must come back bit for
+ * bit.
+ *
+ *   jdarchive info <archive>
+ *   jdarchive csv <archive> <signal|all> [from_us] [to_us]
+ *   jdarchive import <candump.log> <archive>
+ *   jdarchive check
+ *
+******************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "j1939_archive.h"
+#include "j1939_batch.h"
+
+// frames decoded at once by import
+static const std::size_t IMPORT_BATCH = 4096;
+
+static int usage() {
+    std::fprintf(stderr,
+                 "usage: jdarchive info <archive>\n"
+                 "       jdarchive csv <archive> <signal|all> "
+                 "[from_us] [to_us]\n"
+                 "       jdarchive import <candump.log> <archive>\n"
+                 "       jdarchive check\n"
+                 "signals:");
+    for (int i = 0; i < A_SIGNAL_COUNT; i++)
+        std::fprintf(stderr, " %s", archiveSignalName(i));
+    std::fprintf(stderr, "\n");
+    return 1;
+}
+
+static int info(j1939ArchiveReader &reader) {
+    const std::vector<ArchiveIndexEntry> &index = reader.index();
+    std::printf("block,signal,offset,samples,min_time_us,max_time_us,"
+                "min_value,max_value,bytes\n");
+    for (size_t i = 0; i < index.size(); i++) {
+        const ArchiveBlock &block = index[i].block;
+        std::printf("%zu,%s,%llu,%u,%lld,%lld,%g,%g,%u\n", i,
+                    archiveSignalName(block.signal),
+                    static_cast<unsigned long long>(index[i].offset),
+                    block.count, static_cast<long long>(block.minTime),
+                    static_cast<long long>(block.maxTime),
+                    block.minValue, block.maxValue,
+                    unsigned(sizeof(block) + block.timeBytes +
+                             block.valueBytes));
+    }
+    return 0;
+}
+
+static int csv(j1939ArchiveReader &reader, const char *name,
+               qint64 from, qint64 to) {
+    int first = 0;
+    int last = A_SIGNAL_COUNT - 1;
+    if (std::strcmp(name, "all") != 0) {
+        first = last = archiveSignalFromName(name);
+        if (first < 0)
+            return usage();
+    }
+
+    int blocks = 0;
+    std::printf("signal,time_us,value\n");
+    for (int signal = first; signal <= last; signal++) {
+        int read = 0;
+        std::vector<ArchiveSample> samples =
+                reader.query(signal, from, to, &read);
+        blocks += read;
+        for (size_t i = 0; i < samples.size(); i++)
+            std::printf("%s,%lld,%.17g\n", archiveSignalName(signal),
+                        static_cast<long long>(samples[i].time),
+                        samples[i].value);
+    }
+    std::fprintf(stderr, "%d of %zu blocks read\n", blocks,
+                 reader.index().size());
+    return 0;
+}
+
+struct ImportBatch {
+    std::vector<quint32> ids;
+    std::vector<quint8> payloads;
+    std::vector<quint8> lengths;
+    std::vector<qint64> times;
+};
+
+// parses "(sec.usec) can0 18FEF100#0102030405060708", extended ids only
+static bool parseCandump(const char *line, ImportBatch &batch) {
+    long long seconds;
+    unsigned micros;
+    char id[16];
+    char data[32];
+    if (std::sscanf(line, "(%lld.%u) %*s %15[0-9A-Fa-f]#%31[0-9A-Fa-f]",
+                    &seconds, &micros, id, data) != 4 ||
+            std::strlen(id) != 8)
+        return false;
+
+    quint8 payload[BYTE_DATA_PER_PACKET] = {};
+    int length = int(std::strlen(data)) / 2;
+    if (length > BYTE_DATA_PER_PACKET)
+        return false;
+    for (int i = 0; i < length; i++) {
+        char byte[3] = {data[2 * i], data[2 * i + 1], 0};
+        payload[i] = quint8(std::strtoul(byte, nullptr, 16));
+    }
+
+    batch.ids.push_back(quint32(std::strtoul(id, nullptr, 16)));
+    batch.payloads.insert(batch.payloads.end(), payload,
+                          payload + BYTE_DATA_PER_PACKET);
+    batch.lengths.push_back(quint8(length));
+    batch.times.push_back(qint64(seconds) * 1000000 + micros);
+    return true;
+}
+
+static std::size_t flush(j1939BatchDecoder &decoder, ImportBatch &batch,
+                         j1939ArchiveWriter &writer) {
+    decoder.decode(batch.ids.data(), batch.payloads.data(),
+                   batch.lengths.data(), batch.times.data(),
+                   batch.ids.size());
+    for (int signal = 0; signal < A_SIGNAL_COUNT; signal++) {
+        const j1939SampleColumns &column = decoder.columns(signal);
+        for (std::size_t i = 0; i < column.time.size(); i++)
+            writer.append(signal, column.time[i], column.value[i]);
+    }
+    batch.ids.clear();
+    batch.payloads.clear();
+    batch.lengths.clear();
+    batch.times.clear();
+    return decoder.samples();
+}
+
+static int import(const char *log, const char *archive) {
+    std::FILE *input = std::fopen(log, "r");
+    if (!input) {
+        std::fprintf(stderr, "jdarchive: can't read %s\n", log);
+        return 1;
+    }
+    j1939ArchiveWriter writer;
+    if (!writer.open(archive)) {
+        std::fprintf(stderr, "jdarchive: can't write %s\n", archive);
+        std::fclose(input);
+        return 1;
+    }
+
+    j1939BatchDecoder decoder;
+    ImportBatch batch;
+    char line[256];
+    std::size_t frames = 0;
+    std::size_t samples = 0;
+    while (std::fgets(line, sizeof(line), input)) {
+        if (!parseCandump(line, batch))
+            continue;
+        frames++;
+        if (batch.ids.size() == IMPORT_BATCH)
+            samples += flush(decoder, batch, writer);
+    }
+    if (!batch.ids.empty())
+        samples += flush(decoder, batch, writer);
+    std::fclose(input);
+    writer.close();
+
+    std::fprintf(stderr, "%zu frames, %zu samples imported (%s)\n", frames,
+                 samples, j1939BatchDecoder::instructionSet());
+    return 0;
+}
+
+// start of the timestamps written by check
+static const qint64 CHECK_EPOCH = 1700000000000000LL;
+
+static ArchiveSample sample(qint64 time, double value) {
+    ArchiveSample sample;
+    sample.time = time;
+    sample.value = value;
+    return sample;
+}
+
+static double fromBits(quint64 bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// NaN != NaN, so values are compared bit for bit
+static bool sameSamples(const char *name,
+                        const std::vector<ArchiveSample> &expected,
+                        const std::vector<ArchiveSample> &actual) {
+    if (actual.size() != expected.size()) {
+        std::fprintf(stderr, "jdarchive: %s: %zu samples read, %zu written\n",
+                     name, actual.size(), expected.size());
+        return false;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (actual[i].time != expected[i].time ||
+                std::memcmp(&actual[i].value, &expected[i].value,
+                            sizeof(double)) != 0) {
+            std::fprintf(stderr, "jdarchive: %s: sample %zu read as "
+                         "%lld,%.17g, written as %lld,%.17g\n", name, i,
+                         static_cast<long long>(actual[i].time),
+                         actual[i].value,
+                         static_cast<long long>(expected[i].time),
+                         expected[i].value);
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<ArchiveSample> readAll(j1939ArchiveReader &reader,
+                                          int signal) {
+    return reader.query(signal, std::numeric_limits<qint64>::min(),
+                        std::numeric_limits<qint64>::max());
+}
+
+static bool writeArchive(const std::string &path, int signal,
+                  const std::vector<ArchiveSample> &samples,
+                  bool append = false) {
+    j1939ArchiveWriter writer;
+    if (!writer.open(path, append)) {
+        std::fprintf(stderr, "jdarchive: can't write %s\n", path.c_str());
+        return false;
+    }
+    for (size_t i = 0; i < samples.size(); i++)
+        writer.append(signal, samples[i].time, samples[i].value);
+    writer.close();
+    return true;
+}
+
+// writes the samples, reads them back and checks the number of blocks,
+// unless it is 0
+static bool roundTrip(const std::string &path, const char *name,
+                      const std::vector<ArchiveSample> &samples,
+                      size_t blocks) {
+    if (!writeArchive(path, A_TEMPERATURE, samples))
+        return false;
+    j1939ArchiveReader reader;
+    if (!reader.open(path)) {
+        std::fprintf(stderr, "jdarchive: %s: can't read it back\n", name);
+        return false;
+    }
+    if (blocks && reader.index().size() != blocks) {
+        std::fprintf(stderr, "jdarchive: %s: %zu blocks, %zu expected\n",
+                     name, reader.index().size(), blocks);
+        return false;
+    }
+    return sameSamples(name, samples, readAll(reader, A_TEMPERATURE));
+}
+
+static bool checkValues(const std::string &path) {
+    const quint64 BITS[] = {
+        0x0000000000000000ULL,  // +0
+        0x8000000000000000ULL,  // -0
+        0x7FF8000000000000ULL,  // quiet NaN
+        0xFFF8000000000000ULL,  // negative NaN
+        0x7FF0000000000001ULL,  // signaling NaN with payload
+        0x7FF0000000000000ULL,  // +inf
+        0xFFF0000000000000ULL,  // -inf
+        0x0000000000000001ULL,  // smallest denormal
+        0x7FEFFFFFFFFFFFFFULL,  // largest double
+        0x3FF0000000000000ULL,  // 1
+        0x3FF0000000000000ULL,
+        0x8000000000000000ULL,
+        0x0000000000000000ULL,
+        0x7FF8000000000000ULL,
+        0x7FF8000000000000ULL
+    };
+    std::vector<ArchiveSample> samples;
+    qint64 time = CHECK_EPOCH;
+    for (size_t i = 0; i < sizeof(BITS) / sizeof(BITS[0]); i++)
+        samples.push_back(sample(time += 1000, fromBits(BITS[i])));
+
+    // random bit patterns, with runs of repeated and nearby values
+    std::mt19937_64 random(1939);
+    while (samples.size() < ARCHIVE_CHUNK_SAMPLES) {
+        quint64 bits = random();
+        int kind = int(random() % 4);
+        if (kind == 1)
+            bits = quint64(random() % 2) << 63 | 0x7FF0000000000000ULL |
+                    (bits & 0x000FFFFFFFFFFFFFULL);
+        double value = fromBits(bits);
+        if (kind == 2)
+            value = samples.back().value;
+        else if (kind == 3)
+            value = double(random() % 1000) / 8;
+        samples.push_back(sample(time += 1000, value));
+    }
+    return roundTrip(path, "values", samples, 1);
+}
+
+static bool checkTimes(const std::string &path) {
+    std::vector<ArchiveSample> samples;
+    qint64 time = CHECK_EPOCH;
+    for (int i = 0; i < 600; i++) {
+        // equal timestamps, irregular steps and a few steps back
+        int step = i % 7 == 0 ? 0 : i % 11 == 0 ? -250 : (i * 7919) % 5000;
+        samples.push_back(sample(time += step, i));
+        if (i % 13 == 0)
+            samples.push_back(sample(time, -i));
+    }
+    if (!roundTrip(path, "equal times", samples, 1))
+        return false;
+
+    // every delta-of-delta from the smallest to the largest varint
+    samples.clear();
+    time = CHECK_EPOCH;
+    for (int shift = 0; shift < 40; shift++) {
+        samples.push_back(sample(time += qint64(1) << shift, shift));
+        samples.push_back(sample(time, shift));
+    }
+    return roundTrip(path, "large steps", samples, 0);
+}
+
+static bool checkChunks(const std::string &path) {
+    const size_t COUNTS[] = {
+        1, ARCHIVE_CHUNK_SAMPLES - 1, ARCHIVE_CHUNK_SAMPLES,
+        ARCHIVE_CHUNK_SAMPLES + 1, 2 * ARCHIVE_CHUNK_SAMPLES,
+        2 * ARCHIVE_CHUNK_SAMPLES + 1
+    };
+    for (size_t c = 0; c < sizeof(COUNTS) / sizeof(COUNTS[0]); c++) {
+        std::vector<ArchiveSample> samples;
+        for (size_t i = 0; i < COUNTS[c]; i++)
+            samples.push_back(sample(CHECK_EPOCH + qint64(i) * 1000,
+                                     double(i % 100)));
+        char name[32];
+        std::snprintf(name, sizeof(name), "%zu samples", COUNTS[c]);
+        if (!roundTrip(path, name, samples,
+                       (COUNTS[c] + ARCHIVE_CHUNK_SAMPLES - 1) /
+                       ARCHIVE_CHUNK_SAMPLES))
+            return false;
+    }
+
+    // a chunk spans less than ARCHIVE_CHUNK_SPAN_US from its first sample
+    std::vector<ArchiveSample> samples;
+    samples.push_back(sample(CHECK_EPOCH, 1));
+    samples.push_back(sample(CHECK_EPOCH + ARCHIVE_CHUNK_SPAN_US - 1, 2));
+    if (!roundTrip(path, "span - 1", samples, 1))
+        return false;
+    samples.push_back(sample(CHECK_EPOCH + ARCHIVE_CHUNK_SPAN_US, 3));
+    samples.push_back(sample(CHECK_EPOCH + 3 * ARCHIVE_CHUNK_SPAN_US, 4));
+    return roundTrip(path, "span", samples, 3);
+}
+
+static bool checkSignals(const std::string &path) {
+    std::vector<ArchiveSample> samples[A_SIGNAL_COUNT];
+    j1939ArchiveWriter writer;
+    if (!writer.open(path))
+        return false;
+    for (int i = 0; i < 3000; i++) {
+        int signal = (i * 5) % A_SIGNAL_COUNT;
+        ArchiveSample s = sample(CHECK_EPOCH + i * 100, signal + i * 0.5);
+        samples[signal].push_back(s);
+        writer.append(signal, s.time, s.value);
+    }
+    writer.close();
+
+    j1939ArchiveReader reader;
+    if (!reader.open(path))
+        return false;
+    for (int signal = 0; signal < A_SIGNAL_COUNT; signal++) {
+        if (!sameSamples(archiveSignalName(signal), samples[signal],
+                         readAll(reader, signal)))
+            return false;
+    }
+    return true;
+}
+
+// cuts the file and checks what the rebuilt index gives back
+static bool checkCut(const std::string &path, const char *name, quint64 size,
+                     const std::vector<ArchiveSample> &expected) {
+    j1939ArchiveReader reader;
+    if (truncate(path.c_str(), off_t(size)) != 0 || !reader.open(path)) {
+        std::fprintf(stderr, "jdarchive: %s: can't read it back\n", name);
+        return false;
+    }
+    return sameSamples(name, expected, readAll(reader, A_TEMPERATURE));
+}
+
+static bool checkRebuild(const std::string &path) {
+    std::vector<ArchiveSample> samples;
+    for (int i = 0; i < 3 * ARCHIVE_CHUNK_SAMPLES - 100; i++)
+        samples.push_back(sample(CHECK_EPOCH + i * 1000, i * 0.25));
+    if (!writeArchive(path, A_TEMPERATURE, samples))
+        return false;
+
+    std::vector<ArchiveIndexEntry> index;
+    {
+        j1939ArchiveReader reader;
+        if (!reader.open(path) || reader.index().size() != 3)
+            return false;
+        index = reader.index();
+    }
+    const ArchiveIndexEntry &last = index.back();
+    quint64 end = last.offset + sizeof(ArchiveBlock) + last.block.timeBytes +
+            last.block.valueBytes;
+    std::vector<ArchiveSample> whole(samples.begin(),
+                                     samples.begin() +
+                                     2 * ARCHIVE_CHUNK_SAMPLES);
+
+    if (!checkCut(path, "cut index", end + sizeof(ArchiveIndexEntry),
+                  samples) ||
+            !checkCut(path, "no index", end, samples) ||
+            !checkCut(path, "cut block", end - 1, whole) ||
+            !checkCut(path, "cut header", last.offset + 10, whole))
+        return false;
+
+    // appending continues after the last whole block
+    std::vector<ArchiveSample> rest(whole.size() + samples.begin(),
+                                    samples.end());
+    if (!writeArchive(path, A_TEMPERATURE, rest, true))
+        return false;
+    j1939ArchiveReader reader;
+    return reader.open(path) &&
+            sameSamples("append", samples, readAll(reader, A_TEMPERATURE));
+}
+
+static int check() {
+    char path[] = "/tmp/jdarchive-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::fprintf(stderr, "jdarchive: can't create %s\n", path);
+        return 1;
+    }
+    ::close(fd);
+
+    struct Check {
+        const char *name;
+        bool (*run)(const std::string &path);
+    };
+    const Check CHECKS[] = {
+        {"values", checkValues},
+        {"times", checkTimes},
+        {"chunks", checkChunks},
+        {"signals", checkSignals},
+        {"rebuild", checkRebuild}
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(CHECKS) / sizeof(CHECKS[0]); i++) {
+        bool ok = CHECKS[i].run(path);
+        std::printf("%-8s %s\n", CHECKS[i].name, ok ? "ok" : "FAILED");
+        failed += !ok;
+    }
+    unlink(path);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && std::strcmp(argv[1], "check") == 0)
+        return check();
+    if (argc < 3)
+        return usage();
+    if (std::strcmp(argv[1], "import") == 0)
+        return argc == 4 ? import(argv[2], argv[3]) : usage();
+
+    j1939ArchiveReader reader;
+    if (!reader.open(argv[2])) {
+        std::fprintf(stderr, "jdarchive: can't read %s\n", argv[2]);
+        return 1;
+    }
+
+    if (std::strcmp(argv[1], "info") == 0)
+        return info(reader);
+    if (std::strcmp(argv[1], "csv") == 0 && argc >= 4) {
+        qint64 from = std::numeric_limits<qint64>::min();
+        qint64 to = std::numeric_limits<qint64>::max();
+        if (argc >= 5)
+            from = std::strtoll(argv[4], nullptr, 10);
+        if (argc >= 6)
+            to = std::strtoll(argv[5], nullptr, 10);
+        return csv(reader, argv[3], from, to);
+    }
+    return usage();
+}
@@ -0,0 +1,19 @@
+QT -= gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = jdbench
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+        ../../j1939_archive.cpp \
+        ../../j1939_batch.cpp \
+        ../../j1939_decoder.cpp
+
+HEADERS += \
+    ../../j1939_archive.h \
+    ../../j1939_batch.h \
+    ../../j1939_config.h \
+    ../../j1939_decoder.h
@@ -0,0 +1,178 @@
+/******************************************************************************
+ *
+ * jdbench
+ *
+ * Benchmark of the batch decoder against the scalar decode. A log of
+ * random frames is generated, mostly measurement PGNs from several source
+ * addresses, with some DM1 and request frames and some short payloads. It
+ * is decoded frame by frame with j1939Decode() into per signal columns, the
+ * way processFrames() does, and in batches with j1939BatchDecoder. Both
+ * results are checked to be identical before the timings are printed.
+ *
+ * Options:
+ *   -n <frames>            frames in the log, default 4000000
+ *   -b <frames>            frames per batch, default 4096
+ *   -r <runs>              runs of each decoder, the best one is kept,
+ *                          default 5
+ *
+******************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <unistd.h>
+#include "j1939_batch.h"
+#include "j1939_decoder.h"
+
+namespace {
+
+struct Log {
+    std::vector<quint32> ids;
+    std::vector<quint8> payloads;
+    std::vector<quint8> lengths;
+    std::vector<qint64> times;
+};
+
+Log generate(std::size_t frames) {
+    const quint32 PGNS[] = {
+        LINEAR_DISPLACEMENT_PGN, ENGINE_TEMPERATURE_PGN, VEHICLE_POSITION_PGN,
+        VEHICLE_ORIENTATION_PGN, DM1_PGN, REQUEST_PGN
+    };
+    const quint8 ADDRESSES[] = {LINEAR_ADR, TEMP_ADR, POS_ADR, 0x21};
+    std::mt19937 random(1939);
+    Log log;
+    log.ids.resize(frames);
+    log.payloads.resize(frames * BYTE_DATA_PER_PACKET);
+    log.lengths.resize(frames);
+    log.times.resize(frames);
+
+    qint64 time = 1700000000000000LL;
+    for (std::size_t i = 0; i < frames; i++) {
+        // 4 in 5 frames carry measurements
+        int kind = random() % 20;
+        quint32 PGN = kind < 16 ? PGNS[kind % 4] : PGNS[4 + kind % 2];
+        log.ids[i] = quint32(ECU_PRIORITY_LEVEL) << PRIORITY_SHIFT_POSITION |
+                PGN << PGN_SHIFT_POSITION | ADDRESSES[random() % 4];
+        for (int k = 0; k < BYTE_DATA_PER_PACKET; k++)
+            log.payloads[i * BYTE_DATA_PER_PACKET + k] = quint8(random());
+        log.lengths[i] = random() % 100 ? BYTE_DATA_PER_PACKET
+                                        : quint8(random() % 4);
+        time += 100 + random() % 400;
+        log.times[i] = time;
+    }
+    return log;
+}
+
+void decodeScalar(const Log &log, std::size_t first, std::size_t count,
+                  j1939SampleColumns *columns) {
+    j1939Sample samples[DECODE_MAX_SAMPLES];
+    for (int i = 0; i < A_SIGNAL_COUNT; i++) {
+        columns[i].time.clear();
+        columns[i].value.clear();
+        columns[i].source.clear();
+    }
+    for (std::size_t i = first; i < first + count; i++) {
+        int decoded = j1939Decode(log.ids[i],
+                                  &log.payloads[i * BYTE_DATA_PER_PACKET],
+                                  log.lengths[i], log.times[i], samples);
+        for (int k = 0; k < decoded; k++) {
+            j1939SampleColumns &column = columns[samples[k].signal];
+            column.time.push_back(samples[k].time);
+            column.value.push_back(samples[k].value);
+            column.source.push_back(samples[k].source);
+        }
+    }
+}
+
+void decodeBatch(j1939BatchDecoder &decoder, const Log &log,
+                 std::size_t first, std::size_t count) {
+    decoder.decode(&log.ids[first],
+                   &log.payloads[first * BYTE_DATA_PER_PACKET],
+                   &log.lengths[first], &log.times[first], count);
+}
+
+bool sameColumns(const j1939SampleColumns &a, const j1939SampleColumns &b) {
+    return a.time == b.time && a.source == b.source &&
+            a.value.size() == b.value.size() &&
+            (a.value.empty() || std::memcmp(a.value.data(), b.value.data(),
+                                            a.value.size() *
+                                            sizeof(double)) == 0);
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+}
+
+int usage() {
+    fprintf(stderr, "usage: jdbench [-n frames] [-b batch] [-r runs]\n");
+    return 1;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    std::size_t frames = 4000000;
+    std::size_t batch = 4096;
+    int runs = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:r:")) != -1) {
+        switch (opt) {
+        case 'n': frames = std::size_t(atoll(optarg)); break;
+        case 'b': batch = std::size_t(atoll(optarg)); break;
+        case 'r': runs = atoi(optarg); break;
+        default: return usage();
+        }
+    }
+    if (!frames || !batch || runs < 1)
+        return usage();
+
+    Log log = generate(frames);
+    j1939SampleColumns scalar[A_SIGNAL_COUNT];
+    j1939BatchDecoder decoder;
+
+    // check both decoders give the same columns, batch by batch
+    std::size_t samples = 0;
+    for (std::size_t first = 0; first < frames; first += batch) {
+        std::size_t count = std::min(batch, frames - first);
+        decodeScalar(log, first, count, scalar);
+        decodeBatch(decoder, log, first, count);
+        for (int i = 0; i < A_SIGNAL_COUNT; i++) {
+            if (!sameColumns(scalar[i], decoder.columns(i))) {
+                fprintf(stderr, "jdbench: %s differs in batch at frame %zu\n",
+                        archiveSignalName(i), first);
+                return 1;
+            }
+        }
+        samples += decoder.samples();
+    }
+
+    double scalarTime = 1e30;
+    double batchTime = 1e30;
+    for (int run = 0; run < runs; run++) {
+        std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+        for (std::size_t first = 0; first < frames; first += batch)
+            decodeScalar(log, first, std::min(batch, frames - first), scalar);
+        scalarTime = std::min(scalarTime, seconds(start));
+
+        start = std::chrono::steady_clock::now();
+        for (std::size_t first = 0; first < frames; first += batch)
+            decodeBatch(decoder, log, first, std::min(batch, frames - first));
+        batchTime = std::min(batchTime, seconds(start));
+    }
+
+    printf("%zu frames, %zu samples, batches of %zu, %s\n", frames, samples,
+           batch, j1939BatchDecoder::instructionSet());
+    printf("scalar: %8.2f ns/frame %8.1f Mframes/s\n",
+           scalarTime * 1e9 / frames, frames / scalarTime / 1e6);
+    printf("batch:  %8.2f ns/frame %8.1f Mframes/s\n",
+           batchTime * 1e9 / frames, frames / batchTime / 1e6);
+    printf("speedup: %.2fx\n", scalarTime / batchTime);
+    return 0;
+}
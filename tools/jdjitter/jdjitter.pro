@@ -0,0 +1,17 @@
+QT -= gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = jdjitter
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+        ../../j1939_decoder.cpp \
+        ../../j1939_rt.cpp
+
+HEADERS += \
+    ../../j1939_config.h \
+    ../../j1939_decoder.h \
+    ../../j1939_rt.h
@@ -0,0 +1,201 @@
+/******************************************************************************
+ *
+ * jdjitter
+ *
+ * Jitter report of the receive path. Frames of the interface are received
+ * and decoded with j1939Decode() the same way j1939Receiver does, first with
+ * the default scheduling and then with the real-time profile applied, and
+ * the receive-to-decode latencies of both runs are reported side by side:
+ *
+ *   jdsim -i vcan0 -l 0 &
+ *   sudo jdjitter -i vcan0 -s 30 -c 3 -b 4
+ *
+ * The difference shows under load, -b starts busy threads with the default
+ * scheduling to compete with the receive thread. The dashboard prints the
+ * same report on exit, run it with and without JD_RT_PROFILE=1 to compare
+ * the full application.
+ *
+ * Options:
+ *   -i <interface>         CAN interface, default vcan0
+ *   -s <seconds>           duration of each run, default 10
+ *   -c <cpu>               CPU of the real-time run, default any
+ *   -p <priority>          SCHED_FIFO priority, default RT_PRIORITY
+ *   -b <threads>           busy threads during both runs, default 0
+ *
+******************************************************************************/
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "j1939_decoder.h"
+#include "j1939_rt.h"
+
+namespace {
+
+int openSocket(const char *name) {
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0) {
+        perror("jdjitter: socket");
+        return -1;
+    }
+    ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        perror("jdjitter: interface");
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+    sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        perror("jdjitter: bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/******************************************************************************
+* FUNCTION: measure()
+*
+* DESCRIPTION: This function receives and decodes frames for a while and
+*              records the receive-to-decode latency of the decoded ones.
+*
+* PARAMETERS:  fd- the CAN socket.
+*              seconds- duration of the run.
+*              stats- where the latencies are recorded.
+*
+* Return:      None
+******************************************************************************/
+void measure(int fd, double seconds, j1939LatencyStats &stats) {
+    can_frame frame;
+    char control[CMSG_SPACE(sizeof(timeval))];
+    iovec iov;
+    iov.iov_base = &frame;
+    iov.iov_len = sizeof(frame);
+    msghdr message;
+    j1939Sample samples[DECODE_MAX_SAMPLES];
+    qint64 end = realtimeMicros() + qint64(seconds * 1000000);
+
+    // drop what was queued before the run started
+    while (recv(fd, &frame, sizeof(frame), MSG_DONTWAIT) > 0)
+        ;
+
+    while (realtimeMicros() < end) {
+        pollfd descriptor = {fd, POLLIN, 0};
+        if (poll(&descriptor, 1, RT_POLL_MS) <= 0)
+            continue;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &message, MSG_DONTWAIT) < ssize_t(sizeof(frame)) ||
+                !(frame.can_id & CAN_EFF_FLAG))
+            continue;
+
+        qint64 time = 0;
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header;
+             header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET &&
+                    header->cmsg_type == SCM_TIMESTAMP) {
+                timeval stamp;
+                memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+                time = qint64(stamp.tv_sec) * 1000000 + stamp.tv_usec;
+            }
+        }
+        if (!time)
+            continue;
+        if (j1939Decode(frame.can_id & CAN_EFF_MASK, frame.data,
+                        frame.can_dlc, time, samples))
+            stats.record(realtimeMicros() - time);
+    }
+}
+
+int usage() {
+    fprintf(stderr, "usage: jdjitter [-i interface] [-s seconds] [-c cpu] "
+                    "[-p priority] [-b threads]\n");
+    return 1;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    const char *interface = "vcan0";
+    double seconds = 10;
+    int busyThreads = 0;
+    j1939RtProfile profile;
+    profile.enabled = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:s:c:p:b:")) != -1) {
+        switch (opt) {
+        case 'i': interface = optarg; break;
+        case 's': seconds = atof(optarg); break;
+        case 'c': profile.cpu = atoi(optarg); break;
+        case 'p': profile.priority = atoi(optarg); break;
+        case 'b': busyThreads = atoi(optarg); break;
+        default: return usage();
+        }
+    }
+
+    int fd = openSocket(interface);
+    if (fd < 0)
+        return 1;
+
+    std::atomic<bool> busy(true);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < busyThreads; i++)
+        threads.emplace_back([&busy] {
+            volatile unsigned long spin = 0;
+            while (busy.load(std::memory_order_relaxed))
+                spin++;
+        });
+
+    j1939LatencyStats normal;
+    fprintf(stderr, "jdjitter: %.0f s with default scheduling\n", seconds);
+    measure(fd, seconds, normal);
+
+    j1939LatencyStats realtime;
+    QString error;
+    if (!applyRtProfile(profile, &error))
+        fprintf(stderr, "jdjitter: profile not fully applied: %s\n",
+                error.toLocal8Bit().constData());
+    fprintf(stderr, "jdjitter: %.0f s with the real-time profile\n", seconds);
+    measure(fd, seconds, realtime);
+
+    busy = false;
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    close(fd);
+
+    printf("%s\n%s\n", normal.report(QStringLiteral("default scheduling"))
+           .toLocal8Bit().constData(),
+           realtime.report(QStringLiteral("SCHED_FIFO %1, CPU %2")
+                           .arg(profile.priority)
+                           .arg(profile.cpu >= 0
+                                ? QString::number(profile.cpu)
+                                : QStringLiteral("any")))
+           .toLocal8Bit().constData());
+    printf("worst case: %lld us -> %lld us\n",
+           static_cast<long long>(normal.max()),
+           static_cast<long long>(realtime.max()));
+    return 0;
+}
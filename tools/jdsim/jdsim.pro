@@ -0,0 +1,12 @@
+CONFIG += console c++11
+CONFIG -= app_bundle qt
+
+TARGET = jdsim
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp
+
+HEADERS += \
+    ../../j1939_config.h
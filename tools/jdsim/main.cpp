@@ -0,0 +1,520 @@
+/******************************************************************************
+ *
+ * jdsim
+ *
+ * Simulated ECU network standing in for the linear (LINEAR_ADR), temperature
+ * (TEMP_ADR) and position (POS_ADR) devices, meant to run on vcan0:
+ *
+ *   sudo ip link add dev vcan0 type vcan && sudo ip link set vcan0 up
+ *   jdsim -i vcan0 &
+ *   JD_CAN_INTERFACE=vcan0 ./JDInterfaz
+ *
+ * Every PGN decoded by j1939::processFrames() is sent at its own rate, 0
+ * sends it as fast as the socket accepts frames, to saturate the bus. The
+ * heater and linear actuator follow HEATER_SP_PGN and TREAD_POS_PGN with
+ * first order / rate limited plant models. Faults are injected as DM1 and
+ * cleared by DM3/DM11 requests, the dashboard status reset sends DM11.
+ *
+ * Options:
+ *   -i <interface>         CAN interface, default vcan0
+ *   -l <hz>                linear displacement rate, default 10
+ *   -t <hz>                engine temperature rate, default 10
+ *   -p <hz>                vehicle position rate, default 10
+ *   -o <hz>                vehicle orientation rate, default 10
+ *   -f <device>:<fmi>      inject a fault at start (linear|temp|pos)
+ *   -d <seconds>           stop after this time
+ *
+ * Commands on stdin:
+ *   fault <device> <fmi>   activate a DTC on the device
+ *   clear <device>         clear the active DTC of the device
+ *   rate <stream> <hz>     change the rate of linear|temp|pos|orientation
+ *   quit
+ *
+******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "j1939_config.h"
+
+namespace {
+
+const int DM1_SPN_BASE = 520000;
+const double HEATER_TIME_CONSTANT_S = 20.0;
+const double ACTUATOR_SPEED_PER_S = 5.0;
+const double AMBIENT_TEMPERATURE = 20.0;
+
+enum Stream_E {
+    S_LINEAR,
+    S_TEMPERATURE,
+    S_POSITION,
+    S_ORIENTATION,
+    S_DM1,
+    S_COUNT
+};
+
+const char *STREAM_NAMES[S_COUNT] = {
+    "linear", "temp", "pos", "orientation", "dm1"
+};
+
+struct Device {
+    const char *name;
+    unsigned char address;
+    int activeFmi;
+    int previousFmi;
+};
+
+struct Stream {
+    double rate;
+    double next;
+    unsigned long sent;
+};
+
+struct Simulator {
+    int fd = -1;
+    Device devices[3] = {
+        {"linear", LINEAR_ADR, 0, 0},
+        {"temp", TEMP_ADR, 0, 0},
+        {"pos", POS_ADR, 0, 0}
+    };
+    Stream streams[S_COUNT] = {
+        {10, 0, 0}, {10, 0, 0}, {10, 0, 0}, {10, 0, 0}, {1, 0, 0}
+    };
+
+    // plant state
+    double temperature = AMBIENT_TEMPERATURE;
+    double temperatureSP = 25;
+    double linear = 0;
+    double linearSP = 25;
+    double heading = 0;
+    double start = 0;
+    unsigned long dropped = 0;
+};
+
+double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Device *findDevice(Simulator &sim, const std::string &name) {
+    for (int i = 0; i < 3; i++) {
+        if (name == sim.devices[i].name)
+            return &sim.devices[i];
+    }
+    return nullptr;
+}
+
+/******************************************************************************
+* FUNCTION: sendFrame()
+*
+* DESCRIPTION: This function builds a J1939 id the same way as
+*              j1939::prepareCANFrame() and writes the frame without blocking.
+*
+* Return:      false if the socket buffer is full.
+******************************************************************************/
+bool sendFrame(Simulator &sim, unsigned int PGN, unsigned char addr,
+               const unsigned char *payload, int length,
+               unsigned int priority = ECU_PRIORITY_LEVEL) {
+    can_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = CAN_EFF_FLAG | (priority << PRIORITY_SHIFT_POSITION) |
+            (PGN << PGN_SHIFT_POSITION) | addr;
+    frame.can_dlc = length;
+    memcpy(frame.data, payload, length);
+    if (write(sim.fd, &frame, sizeof(frame)) != sizeof(frame)) {
+        if (errno != EAGAIN && errno != ENOBUFS)
+            perror("jdsim: write");
+        return false;
+    }
+    return true;
+}
+
+void putDTC(unsigned char *payload, const Device &device, int fmi) {
+    unsigned int spn = DM1_SPN_BASE + device.address;
+    payload[2] = spn & 0xFF;
+    payload[3] = (spn >> 8) & 0xFF;
+    payload[4] = ((spn >> 11) & SPN_MSB_MASK) | (fmi & FMI_MASK);
+    payload[5] = 1;
+}
+
+/******************************************************************************
+* FUNCTION: sendStream()
+*
+* DESCRIPTION: This function sends one frame of a stream with the current
+*              plant values, encoded as processFrames() decodes them.
+*
+* Return:      false if the socket buffer is full.
+******************************************************************************/
+bool sendStream(Simulator &sim, int stream, double time) {
+    unsigned char payload[BYTE_DATA_PER_PACKET];
+    memset(payload, 0xFF, sizeof(payload));
+
+    switch (stream) {
+    case S_LINEAR:{
+        unsigned int data = unsigned(sim.linear * LINEAR_DISPLACEMENT_CONSTANT);
+        payload[LINEAR_DISPLACEMENT_MSB] = (data >> MSB_SHIFT_POSITION) & 0xFF;
+        payload[LINEAR_DISPLACEMENT_LSB] = data & 0xFF;
+        return sendFrame(sim, LINEAR_DISPLACEMENT_PGN, LINEAR_ADR, payload, 8);
+    }
+    case S_TEMPERATURE:{
+        int data = int(std::lround(sim.temperature)) + ENGINE_TEMPERATURE_OFFSET;
+        payload[ENGINE_TEMPERATURE_B] = (unsigned char)(data < 0 ? 0 :
+                                                        data > 0xFA ? 0xFA : data);
+        return sendFrame(sim, ENGINE_TEMPERATURE_PGN, TEMP_ADR, payload, 8);
+    }
+    case S_POSITION:{
+        // the vehicle drives a circle around the center of the map
+        unsigned int x = unsigned(200 + 150 * std::cos(time / 10));
+        unsigned int y = unsigned(200 + 150 * std::sin(time / 10));
+        payload[VEHICLE_POSITION_X_MSB] = (x >> MSB_SHIFT_POSITION) & 0xFF;
+        payload[VEHICLE_POSITION_X_LSB] = x & 0xFF;
+        payload[VEHICLE_POSITION_Y_MSB] = (y >> MSB_SHIFT_POSITION) & 0xFF;
+        payload[VEHICLE_POSITION_Y_LSB] = y & 0xFF;
+        return sendFrame(sim, VEHICLE_POSITION_PGN, POS_ADR, payload, 8);
+    }
+    case S_ORIENTATION:{
+        // one turn every 10 seconds
+        sim.heading = std::fmod(time * 36, 360.0);
+        unsigned int data = unsigned(sim.heading * ORIENTATION_DEGREES_CONSTANT);
+        payload[VEHICLE_ORIENTATION_X_MSB] = (data >> MSB_SHIFT_POSITION) & 0xFF;
+        payload[VEHICLE_ORIENTATION_X_LSB] = data & 0xFF;
+        return sendFrame(sim, VEHICLE_ORIENTATION_PGN, POS_ADR, payload, 8);
+    }
+    case S_DM1:{
+        // faulty devices repeat their DM1, as required once per second
+        for (int i = 0; i < 3; i++) {
+            const Device &device = sim.devices[i];
+            if (!device.activeFmi)
+                continue;
+            payload[0] = DM_LAMP_AMBER_WARNING;
+            payload[1] = DM_LAMP_RESERVED;
+            putDTC(payload, device, device.activeFmi);
+            sendFrame(sim, DM1_PGN, device.address, payload, 8);
+        }
+        return true;
+    }
+    }
+    return true;
+}
+
+void sendDM(Simulator &sim, unsigned int PGN, const Device &device, int fmi) {
+    unsigned char payload[BYTE_DATA_PER_PACKET];
+    memset(payload, 0, sizeof(payload));
+    payload[0] = fmi ? DM_LAMP_AMBER_WARNING : DM_LAMP_NO_FAULTS;
+    payload[1] = DM_LAMP_RESERVED;
+    payload[6] = payload[7] = 0xFF;
+    if (fmi)
+        putDTC(payload, device, fmi);
+    sendFrame(sim, PGN, device.address, payload, 8);
+}
+
+void sendAck(Simulator &sim, const Device &device, unsigned char control,
+             unsigned int PGN, unsigned char requester) {
+    unsigned char payload[BYTE_DATA_PER_PACKET];
+    memset(payload, 0xFF, sizeof(payload));
+    payload[0] = control;
+    payload[4] = requester;
+    payload[5] = PGN & 0xFF;
+    payload[6] = (PGN >> 8) & 0xFF;
+    payload[7] = (PGN >> 16) & 0xFF;
+    sendFrame(sim, ACK_PGN | requester, device.address, payload, 8);
+}
+
+/******************************************************************************
+* FUNCTION: handleRequest()
+*
+* DESCRIPTION: This function answers a Request PGN for one device: DM1, DM2,
+*              DM3 (clear previously active) and DM11 (clear active). Other
+*              PGNs are NACKed when the request was addressed to the device.
+******************************************************************************/
+void handleRequest(Simulator &sim, Device &device, unsigned int PGN,
+                   unsigned char requester, bool global) {
+    switch (PGN) {
+    case DM1_PGN:
+        sendDM(sim, DM1_PGN, device, device.activeFmi);
+        break;
+    case DM2_PGN:
+        sendDM(sim, DM2_PGN, device, device.previousFmi);
+        break;
+    case DM3_PGN:
+        device.previousFmi = 0;
+        sendAck(sim, device, ACK_CONTROL_ACK, PGN, requester);
+        break;
+    case DM11_PGN:
+        if (device.activeFmi)
+            device.previousFmi = device.activeFmi;
+        device.activeFmi = 0;
+        printf("jdsim: %s faults reset\n", device.name);
+        sendAck(sim, device, ACK_CONTROL_ACK, PGN, requester);
+        break;
+    default:
+        if (!global)
+            sendAck(sim, device, ACK_CONTROL_NACK, PGN, requester);
+        break;
+    }
+}
+
+/******************************************************************************
+* FUNCTION: receive()
+*
+* DESCRIPTION: This function reads the frames sent by the dashboard: the
+*              setpoints and Request PGNs.
+******************************************************************************/
+void receive(Simulator &sim) {
+    can_frame frame;
+    while (read(sim.fd, &frame, sizeof(frame)) == sizeof(frame)) {
+        if (!(frame.can_id & CAN_EFF_FLAG))
+            continue;
+        unsigned int canId = frame.can_id & CAN_EFF_MASK;
+        unsigned int PGN = (canId & PGN_MASK) >> PGN_SHIFT_POSITION;
+        unsigned char PDUFormat = (canId & PDU_FORMAT_MASK) >>
+                PDU_FORMAT_SHIFT_POSITION;
+        unsigned char address = canId & ADR_MASK;
+
+        if (PDUFormat == (REQUEST_PGN >> PGN_SHIFT_POSITION) &&
+                frame.can_dlc >= REQUEST_PGN_LENGTH) {
+            unsigned char destination = PGN & 0xFF;
+            unsigned int requested = frame.data[0] | frame.data[1] << 8 |
+                    frame.data[2] << 16;
+            for (int i = 0; i < 3; i++) {
+                Device &device = sim.devices[i];
+                if (destination == GLOBAL_ADR || destination == device.address)
+                    handleRequest(sim, device, requested, address,
+                                  destination == GLOBAL_ADR);
+            }
+            continue;
+        }
+
+        // the dashboard puts the target device in the source address field
+        if (PGN == HEATER_SP_PGN && address == TEMP_ADR && frame.can_dlc > 0) {
+            sim.temperatureSP = frame.data[HEATER_SETPOINT_BYTE];
+        } else if (PGN == TREAD_POS_PGN && address == LINEAR_ADR &&
+                   frame.can_dlc > 3) {
+            sim.linearSP = frame.data[3];
+        }
+    }
+}
+
+/******************************************************************************
+* FUNCTION: command()
+*
+* DESCRIPTION: This function executes a command line read from stdin,
+*              without its line feed.
+*
+* Return:      false on quit.
+******************************************************************************/
+bool command(Simulator &sim, const char *line) {
+    char verb[16] = {0};
+    char name[16] = {0};
+    double value = 0;
+    int fields = sscanf(line, "%15s %15s %lf", verb, name, &value);
+    if (fields < 1)
+        return true;
+    std::string cmd(verb);
+
+    if (cmd == "quit")
+        return false;
+    if (cmd == "fault" && fields == 3 && findDevice(sim, name)) {
+        findDevice(sim, name)->activeFmi = int(value) & FMI_MASK;
+        sim.streams[S_DM1].next = 0;
+    } else if (cmd == "clear" && fields >= 2 && findDevice(sim, name)) {
+        Device *device = findDevice(sim, name);
+        device->previousFmi = device->activeFmi;
+        device->activeFmi = 0;
+    } else if (cmd == "rate" && fields == 3) {
+        for (int i = 0; i < S_DM1; i++) {
+            if (std::string(name) == STREAM_NAMES[i])
+                sim.streams[i].rate = value;
+        }
+    } else {
+        printf("jdsim: unknown command: %s\n", line);
+    }
+    return true;
+}
+
+/******************************************************************************
+* FUNCTION: readCommands()
+*
+* DESCRIPTION: This function reads what is available on stdin and executes
+*              every complete line. stdin is read directly, stdio would keep
+*              the lines after the first one in its buffer where poll() does
+*              not see them. At EOF the last unterminated line is executed.
+*
+* Return:      false on quit.
+******************************************************************************/
+bool readCommands(Simulator &sim, std::string &input, bool &stdinOpen) {
+    char buffer[256];
+    ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (length < 0 && (errno == EINTR || errno == EAGAIN))
+        return true;
+    if (length <= 0) {
+        stdinOpen = false;
+        return input.empty() || command(sim, input.c_str());
+    }
+
+    input.append(buffer, size_t(length));
+    size_t end;
+    while ((end = input.find('\n')) != std::string::npos) {
+        std::string line = input.substr(0, end);
+        input.erase(0, end + 1);
+        if (!command(sim, line.c_str()))
+            return false;
+    }
+    return true;
+}
+
+void updatePlants(Simulator &sim, double dt) {
+    sim.temperature += (sim.temperatureSP - sim.temperature) *
+            (1 - std::exp(-dt / HEATER_TIME_CONSTANT_S));
+    double step = ACTUATOR_SPEED_PER_S * dt;
+    double error = sim.linearSP - sim.linear;
+    sim.linear += std::fabs(error) < step ? error : (error > 0 ? step : -step);
+}
+
+int openSocket(const char *name) {
+    int fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK, CAN_RAW);
+    if (fd < 0) {
+        perror("jdsim: socket");
+        return -1;
+    }
+    ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        perror("jdsim: interface");
+        close(fd);
+        return -1;
+    }
+    sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        perror("jdsim: bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int usage() {
+    fprintf(stderr, "usage: jdsim [-i interface] [-l hz] [-t hz] [-p hz] "
+                    "[-o hz] [-f device:fmi] [-d seconds]\n");
+    return 1;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    Simulator sim;
+    const char *interface = "vcan0";
+    double duration = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:l:t:p:o:f:d:")) != -1) {
+        switch (opt) {
+        case 'i': interface = optarg; break;
+        case 'l': sim.streams[S_LINEAR].rate = atof(optarg); break;
+        case 't': sim.streams[S_TEMPERATURE].rate = atof(optarg); break;
+        case 'p': sim.streams[S_POSITION].rate = atof(optarg); break;
+        case 'o': sim.streams[S_ORIENTATION].rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'f':{
+            std::string fault(optarg);
+            size_t colon = fault.find(':');
+            Device *device = findDevice(sim, fault.substr(0, colon));
+            if (!device || colon == std::string::npos)
+                return usage();
+            device->activeFmi = atoi(fault.c_str() + colon + 1) & FMI_MASK;
+            break;
+        }
+        default:
+            return usage();
+        }
+    }
+
+    sim.fd = openSocket(interface);
+    if (sim.fd < 0)
+        return 1;
+
+    sim.start = now();
+    double last = sim.start;
+    double report = sim.start + 1;
+    unsigned long reported = 0;
+    bool running = true;
+    bool stdinOpen = true;
+    std::string input;
+
+    while (running) {
+        double time = now();
+        updatePlants(sim, time - last);
+        last = time;
+
+        // send every stream that is due, rate 0 streams whenever possible
+        double wait = 0.1;
+        bool flooding = false;
+        for (int i = 0; i < S_COUNT; i++) {
+            Stream &stream = sim.streams[i];
+            if (stream.rate < 0)
+                continue;
+            if (stream.rate == 0) {
+                flooding = true;
+                if (sendStream(sim, i, time - sim.start))
+                    stream.sent++;
+                else
+                    sim.dropped++;
+                continue;
+            }
+            if (time >= stream.next) {
+                if (sendStream(sim, i, time - sim.start))
+                    stream.sent++;
+                else
+                    sim.dropped++;
+                stream.next = std::max(stream.next + 1 / stream.rate, time);
+            }
+            wait = std::min(wait, stream.next - time);
+        }
+
+        // stdin leaves the poll set at EOF, e.g. /dev/null when run with &
+        pollfd fds[2] = {
+            {sim.fd, short(POLLIN | (flooding ? POLLOUT : 0)), 0},
+            {STDIN_FILENO, POLLIN, 0}
+        };
+        poll(fds, stdinOpen ? 2 : 1,
+             flooding ? 10 : int(std::max(wait, 0.0) * 1000));
+        if (fds[0].revents & POLLIN)
+            receive(sim);
+        if (stdinOpen && (fds[1].revents & (POLLIN | POLLHUP)))
+            running = readCommands(sim, input, stdinOpen);
+
+        if (time >= report) {
+            unsigned long total = 0;
+            for (int i = 0; i < S_COUNT; i++)
+                total += sim.streams[i].sent;
+            printf("jdsim: %lu frames/s, dropped %lu, T %.1f/%.0f, "
+                   "linear %.1f/%.0f\n", total - reported, sim.dropped,
+                   sim.temperature, sim.temperatureSP, sim.linear,
+                   sim.linearSP);
+            fflush(stdout);
+            reported = total;
+            report += 1;
+        }
+        if (duration > 0 && time - sim.start >= duration)
+            running = false;
+    }
+    close(sim.fd);
+    return 0;
+}
@@ -0,0 +1,17 @@
+QT -= gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = jdsnapshot
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+        ../../j1939_archive.cpp \
+        ../../j1939_snapshot.cpp
+
+HEADERS += \
+    ../../j1939_archive.h \
+    ../../j1939_config.h \
+    ../../j1939_snapshot.h
@@ -0,0 +1,272 @@
+/******************************************************************************
+ *
+ * jdsnapshot
+ *
+ * Command line tool to print the warm-start snapshot kept by the dashboard
+ * (JD_SNAPSHOT), and to check the snapshot codec.
+ *
+ * check encodes snapshots and decodes them back: a full state with both DTC
+ * stores, an empty one and short DTCs. Snapshots with a bad CRC, magic,
+ * version, DTC count or size, and every truncation, must be rejected
+ * without touching the decoded state. A snapshot is also written with
+ * j1939SnapshotWriter to a temporary file and loaded with loadSnapshot().
+ *
+ *   jdsnapshot dump <snapshot>
+ *   jdsnapshot check
+ *
+******************************************************************************/
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <limits>
+#include <unistd.h>
+#include "j1939_snapshot.h"
+
+static const char *FAULT_NAMES[F_COUNT] = {
+    "tachometer", "fuel_gauge", "thermometer", "linear", "temperature",
+    "position"
+};
+
+static int usage() {
+    std::fprintf(stderr, "usage: jdsnapshot dump <snapshot>\n"
+                         "       jdsnapshot check\n");
+    return 1;
+}
+
+static void printDTCs(const char *store, const QMap<quint8, QByteArray> &DTCs) {
+    for (QMap<quint8, QByteArray>::const_iterator it = DTCs.constBegin();
+         it != DTCs.constEnd(); ++it) {
+        std::printf("%s 0x%02X", store, it.key());
+        for (int i = 0; i < it.value().size(); i++)
+            std::printf(" %02X", quint8(it.value().at(i)));
+        std::printf("\n");
+    }
+}
+
+static int dump(const char *path) {
+    j1939Snapshot snapshot;
+    QString error;
+    if (!loadSnapshot(QString::fromLocal8Bit(path), &snapshot, &error)) {
+        std::fprintf(stderr, "jdsnapshot: %s: %s\n", path,
+                     error.toLocal8Bit().constData());
+        return 1;
+    }
+
+    const SnapshotState &state = snapshot.state;
+    for (int i = 0; i < A_SIGNAL_COUNT; i++)
+        std::printf("%-16s %lld %.17g\n", archiveSignalName(i),
+                    static_cast<long long>(state.time[i]), state.value[i]);
+    std::printf("temp_sp %u\nlinear_sp %u\n", state.tempSP, state.linearSP);
+    for (int i = 0; i < F_COUNT; i++)
+        std::printf("%-16s faults 0x%02X new 0x%02X\n", FAULT_NAMES[i],
+                    state.faultStates[i], state.newFaults[i]);
+    std::printf("addresses");
+    for (int address = 0; address < SNAPSHOT_ADDRESS_BYTES * 8; address++) {
+        if (state.addresses[address / 8] & (1 << (address % 8)))
+            std::printf(" 0x%02X", address);
+    }
+    std::printf("\n");
+    printDTCs("active", snapshot.activeDTCs);
+    printDTCs("previous", snapshot.previousDTCs);
+    return 0;
+}
+
+// a state with every field set, special values included
+static j1939Snapshot fullSnapshot() {
+    j1939Snapshot snapshot;
+    SnapshotState &state = snapshot.state;
+    std::memset(&state, 0, sizeof(state));
+    const double VALUES[] = {
+        21.5, -0.0, std::numeric_limits<double>::quiet_NaN(),
+        std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::denorm_min(),
+        std::numeric_limits<double>::max(), 0.1
+    };
+    for (int i = 0; i < A_SIGNAL_COUNT; i++) {
+        state.time[i] = i == 3 ? 0 : 1700000000000000LL + i * 12345;
+        state.value[i] = VALUES[i % (sizeof(VALUES) / sizeof(VALUES[0]))];
+    }
+    state.tempSP = 85;
+    state.linearSP = 255;
+    for (int i = 0; i < F_COUNT; i++) {
+        state.faultStates[i] = quint8(0x10 + i);
+        state.newFaults[i] = quint8(i & 1);
+    }
+    state.addresses[LINEAR_ADR / 8] |= 1 << (LINEAR_ADR % 8);
+    state.addresses[TEMP_ADR / 8] |= 1 << (TEMP_ADR % 8);
+    state.addresses[0xFF / 8] |= 1 << (0xFF % 8);
+
+    snapshot.activeDTCs.insert(LINEAR_ADR, QByteArray("\x01\x02\x03\x04", 4));
+    snapshot.activeDTCs.insert(0x00, QByteArray("\xFF\xFF\xFF\xFF", 4));
+    snapshot.previousDTCs.insert(LINEAR_ADR,
+                                 QByteArray("\x05\x06\x07\x08", 4));
+    snapshot.previousDTCs.insert(POS_ADR, QByteArray("\x00\x00\x00\x01", 4));
+    snapshot.previousDTCs.insert(0xFF, QByteArray("\x7F\x80\x00\x00", 4));
+    return snapshot;
+}
+
+// states are compared bit for bit, NaN != NaN
+static bool sameSnapshot(const char *name, const j1939Snapshot &expected,
+                         const j1939Snapshot &actual) {
+    SnapshotState state = expected.state;
+    state.DTCCount = quint16(expected.activeDTCs.size() +
+                             expected.previousDTCs.size());
+    if (std::memcmp(&state, &actual.state, sizeof(state)) != 0 ||
+            actual.activeDTCs != expected.activeDTCs ||
+            actual.previousDTCs != expected.previousDTCs) {
+        std::fprintf(stderr, "jdsnapshot: %s: decoded state differs\n", name);
+        return false;
+    }
+    return true;
+}
+
+static bool roundTrip(const char *name, const j1939Snapshot &snapshot,
+                      const j1939Snapshot &expected) {
+    QByteArray data = encodeSnapshot(snapshot);
+    j1939Snapshot decoded;
+    if (!decodeSnapshot(data.constData(), size_t(data.size()), &decoded)) {
+        std::fprintf(stderr, "jdsnapshot: %s: rejected\n", name);
+        return false;
+    }
+    return sameSnapshot(name, expected, decoded);
+}
+
+static bool checkRoundTrip() {
+    j1939Snapshot full = fullSnapshot();
+    j1939Snapshot empty;
+    std::memset(&empty.state, 0, sizeof(empty.state));
+
+    // short DTCs are padded with zeros, long ones cut
+    j1939Snapshot padded = full;
+    padded.activeDTCs.insert(TEMP_ADR, QByteArray("\x09", 1));
+    padded.previousDTCs.insert(TEMP_ADR, QByteArray("\x01\x02\x03\x04\x05", 5));
+    j1939Snapshot expected = padded;
+    expected.activeDTCs.insert(TEMP_ADR, QByteArray("\x09\x00\x00\x00", 4));
+    expected.previousDTCs.insert(TEMP_ADR, QByteArray("\x01\x02\x03\x04", 4));
+
+    return roundTrip("full", full, full) &&
+            roundTrip("empty", empty, empty) &&
+            roundTrip("short DTC", padded, expected);
+}
+
+// the decoded state must be left as it was
+static bool rejected(const char *name, const QByteArray &data) {
+    const j1939Snapshot original = fullSnapshot();
+    j1939Snapshot decoded = original;
+    if (decodeSnapshot(data.constData(), size_t(data.size()), &decoded)) {
+        std::fprintf(stderr, "jdsnapshot: %s: accepted\n", name);
+        return false;
+    }
+    if (std::memcmp(&decoded.state, &original.state,
+                    sizeof(original.state)) != 0 ||
+            decoded.activeDTCs != original.activeDTCs ||
+            decoded.previousDTCs != original.previousDTCs) {
+        std::fprintf(stderr, "jdsnapshot: %s: state changed\n", name);
+        return false;
+    }
+    return true;
+}
+
+// rewrites the CRC after a change of the body
+static void seal(QByteArray &data) {
+    SnapshotHeader header;
+    std::memcpy(&header, data.constData(), sizeof(header));
+    header.crc = snapshotCrc(data.constData() + sizeof(header),
+                             size_t(data.size()) - sizeof(header));
+    data.replace(0, int(sizeof(header)),
+                 QByteArray(reinterpret_cast<const char *>(&header),
+                            sizeof(header)));
+}
+
+static bool checkRejected() {
+    const QByteArray data = encodeSnapshot(fullSnapshot());
+    const int stateAt = int(sizeof(SnapshotHeader));
+    const int countAt = stateAt + int(offsetof(SnapshotState, DTCCount));
+
+    QByteArray body = data;
+    body[stateAt + 5] = char(body.at(stateAt + 5) ^ 0x20);
+    QByteArray crc = data;
+    crc[int(offsetof(SnapshotHeader, crc))] =
+            char(crc.at(int(offsetof(SnapshotHeader, crc))) ^ 1);
+    QByteArray magic = data;
+    magic[0] = 'X';
+    QByteArray version = data;
+    version[int(offsetof(SnapshotHeader, version))] = SNAPSHOT_VERSION + 1;
+    QByteArray count = data;
+    count[countAt] = char(count.at(countAt) + 1);
+    seal(count);
+    QByteArray longer = data + QByteArray(1, '\0');
+
+    if (!rejected("body bit", body) || !rejected("CRC bit", crc) ||
+            !rejected("magic", magic) || !rejected("version", version) ||
+            !rejected("DTC count", count) || !rejected("extra byte", longer))
+        return false;
+    for (int size = 0; size < data.size(); size++) {
+        if (!rejected("truncated", data.left(size))) {
+            std::fprintf(stderr, "jdsnapshot: at %d of %d bytes\n", size,
+                         data.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkFile() {
+    char path[] = "/tmp/jdsnapshot-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return false;
+    ::close(fd);
+
+    QString error;
+    j1939Snapshot loaded;
+    bool ok = !loadSnapshot(QString::fromLocal8Bit(path), &loaded, &error);
+    if (!ok)
+        std::fprintf(stderr, "jdsnapshot: empty file accepted\n");
+
+    j1939Snapshot snapshot = fullSnapshot();
+    {
+        j1939SnapshotWriter writer(QString::fromLocal8Bit(path));
+        writer.start();
+        writer.submit(encodeSnapshot(snapshot));
+        // the pending snapshot is written before the thread ends
+    }
+    if (ok && !loadSnapshot(QString::fromLocal8Bit(path), &loaded, &error)) {
+        std::fprintf(stderr, "jdsnapshot: written file rejected: %s\n",
+                     error.toLocal8Bit().constData());
+        ok = false;
+    }
+    ok = ok && sameSnapshot("file", snapshot, loaded);
+    unlink(path);
+    return ok;
+}
+
+static int check() {
+    struct Check {
+        const char *name;
+        bool (*run)();
+    };
+    const Check CHECKS[] = {
+        {"decode", checkRoundTrip},
+        {"reject", checkRejected},
+        {"file", checkFile}
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(CHECKS) / sizeof(CHECKS[0]); i++) {
+        bool ok = CHECKS[i].run();
+        std::printf("%-8s %s\n", CHECKS[i].name, ok ? "ok" : "FAILED");
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && std::strcmp(argv[1], "check") == 0)
+        return check();
+    if (argc == 3 && std::strcmp(argv[1], "dump") == 0)
+        return dump(argv[2]);
+    return usage();
+}